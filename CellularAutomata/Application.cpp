@@ -1,4 +1,6 @@
 ﻿#include "Application.h"
+#include <algorithm>
+#include <iostream>
 #include <SFML/Graphics.hpp>
 
 #include "core/CoreTypes.h"
@@ -12,15 +14,33 @@ namespace App
     constexpr int textScale = 3;
     constexpr int maxBrushSize = 4;
 
+    void printErrors(const Parser& parser)
+    {
+        for (const ParseError& error : parser.getErrors())
+        {
+            std::cerr << error.file;
+            if (error.line > 0)
+            {
+                std::cerr << ':' << error.line << ':' << error.column;
+            }
+            std::cerr << ": error: " << error.message << std::endl;
+        }
+    }
 }
 
 
-void Application::load()
+bool Application::load()
 {
     font.openFromFile("resources/arial.ttf");
     
     Parser parser = Parser();
-    parser.parse();
+    const bool parsed = parser.parse();
+    configWatcher.watch(parser.getSources());
+    if (!parsed)
+    {
+        App::printErrors(parser);
+        return false;
+    }
 
     auto [w,h] = parser.getDimensions();
     pixelSize = parser.getPixelSize();
@@ -30,9 +50,48 @@ void Application::load()
     
     grid.initialize(w, h);
     grid.loadCellTypes(parser.getCells());
+    auto [domainRows, domainColumns] = parser.getDomains();
+    grid.setDomains(domainRows, domainColumns, parser.getThreadCount(), parser.getPinThreads(), parser.getDeterministic());
+    grid.setLiquidLevelling(parser.getLiquidLevelling());
+    grid.setEngine(parser.getEngine());
+    grid.setChunkCompression(parser.getChunkSleepTicks());
+    history.setMemoryBudget(static_cast<size_t>(parser.getHistoryBudget()) * 1024 * 1024);
+    history.checkpoint(grid);
+    checkpointInterval = parser.getCheckpointInterval();
+    if (!parser.getControlName().empty() && !controlServer.open(parser.getControlName(), grid))
+    {
+        std::cerr << "cannot open the control interface '" << parser.getControlName() << "'" << std::endl;
+    }
+    stepBudget.maxTime = std::chrono::milliseconds(parser.getStepBudget());
 
     matterNames = grid.getCellNames();
     matterNames.resize(std::min(matterNames.size(), App::maxMatters));
+    return true;
+}
+
+void Application::reloadConfig()
+{
+    Parser parser = Parser();
+    const bool parsed = parser.parse();
+    // includes may have been added or removed, so the watched set follows the latest parse
+    configWatcher.watch(parser.getSources());
+    if (!parsed)
+    {
+        App::printErrors(parser);
+        return;
+    }
+
+    const std::string activeMatterName = getActiveMatterName();
+    grid.reloadCellTypes(parser.getCells());
+    controlServer.publishMaterials(grid);
+    // the matter ids of the old checkpoints don't hold anymore
+    history.clear();
+    history.checkpoint(grid);
+
+    matterNames = grid.getCellNames();
+    matterNames.resize(std::min(matterNames.size(), App::maxMatters));
+    auto it = std::find(matterNames.begin(), matterNames.end(), activeMatterName);
+    activeMatter = it != matterNames.end() ? static_cast<int>(it - matterNames.begin()) : 0;
 }
 
 void Application::tryChangeActiveMatter(int newActiveMatter)
@@ -66,20 +125,62 @@ std::pair<sf::Vector2i, sf::Vector2i> Application::getBrushBounds(const sf::Rend
 
 void Application::drawGrid(sf::RenderWindow& window)
 {
-    const int rows = height / pixelSize;
-    const int columns = width / pixelSize;
-    for(int r = 0; r < rows; ++r)
+    sf::CircleShape shape(pixelSize / 2, 5);
+    auto drawCell = [&window, &shape, this](int r, int c)
+    {
+        shape.setPosition(sf::Vector2f(c * pixelSize, r * pixelSize));
+        window.draw(shape);
+    };
+    auto setColor = [&shape](const CellTraits& traits)
+    {
+        shape.setFillColor(sf::Color(traits.color[0], traits.color[1], traits.color[2]));
+    };
+
+    for (int chunkRow = 0; chunkRow < grid.getChunkRows(); ++chunkRow)
     {
-        for (int c = 0; c < columns; ++c)
+        for (int chunkColumn = 0; chunkColumn < grid.getChunkColumns(); ++chunkColumn)
         {
-            if (grid.getCell(r, c))
+            const int top = chunkRow * ChunkSize;
+            const int left = chunkColumn * ChunkSize;
+            const int bottom = std::min(top + ChunkSize, grid.getHeight());
+            const int right = std::min(left + ChunkSize, grid.getWidth());
+
+            // all the cells of a run have the same matter, a compressed chunk is drawn run by run
+            if (const std::vector<CellRun>* runs = grid.getChunkRuns(chunkRow, chunkColumn))
             {
-                sf::CircleShape shape(pixelSize / 2, 5);
-                auto col = grid.getCell(r, c)->getTraits().color;
-                shape.setFillColor(sf::Color(col[0], col[1], col[2]));
-                shape.setPosition(sf::Vector2f(c * pixelSize, r * pixelSize));
+                int r = top;
+                int c = left;
+                for (const CellRun& run : *runs)
+                {
+                    if (run.material != NoMaterial)
+                    {
+                        setColor(grid.getCellDefault(run.material)->getTraits());
+                        for (int i = 0; i < run.length; ++i)
+                        {
+                            drawCell(r, c + i);
+                        }
+                    }
+                    c += run.length;
+                    if (c == right)
+                    {
+                        ++r;
+                        c = left;
+                    }
+                }
+                continue;
+            }
 
-                window.draw(shape);
+            for (int r = top; r < bottom; ++r)
+            {
+                for (int c = left; c < right; ++c)
+                {
+                    const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+                    if (cell)
+                    {
+                        setColor(cell->getTraits());
+                        drawCell(r, c);
+                    }
+                }
             }
         }
     }
@@ -102,6 +203,17 @@ void Application::drawInfo(sf::RenderWindow& window)
     selectedMatterText.setCharacterSize(pixelSize * App::textScale);
     window.draw(selectedMatterText);
 
+    // draw the work that is behind
+    const int deferredCount = grid.getDeferredCount();
+    if (deferredCount > 0)
+    {
+        sf::Text deferredText(font);
+        deferredText.setString("deferred: " + std::to_string(deferredCount));
+        deferredText.setCharacterSize(pixelSize * App::textScale / 2);
+        deferredText.setPosition(sf::Vector2f(0, pixelSize * App::textScale * 1.5f));
+        window.draw(deferredText);
+    }
+
     // draw brush
     auto [startPosition, endPosition] = getBrushBounds(window);
     std::array line = {
@@ -114,20 +226,19 @@ void Application::drawInfo(sf::RenderWindow& window)
     window.draw(line.data(), line.size(), sf::PrimitiveType::LineStrip);
 }
 
-void Application::handleMouse(sf::RenderWindow& window)
+sf::Vector2i Application::toCell(sf::Vector2i position) const
+{
+    // x is a column and y is a row
+    return sf::Vector2i(position.x / pixelSize, position.y / pixelSize);
+}
+
+void Application::handleMouse()
 {
-    if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left))
+    // everything the mouse went through since the last frame goes to the grid as one edit
+    GridEdit edit = brushStroke.takeEdit(grid.getMaterialId(getActiveMatterName()), brushSize - 1);
+    if (!edit.spans.empty())
     {
-        auto [startPosition, endPosition] = getBrushBounds(window);
-        for (int i = startPosition.x; i < endPosition.x; i += pixelSize)
-        {
-            for (int j = startPosition.y; j < endPosition.y; j += pixelSize)
-            {
-                const int r = j / pixelSize;
-                const int c = i / pixelSize;
-                grid.createCell(r, c, getActiveMatterName());
-            }
-        }
+        grid.applyEdit(edit);
     }
 }
 
@@ -139,6 +250,30 @@ void Application::handleEvents(sf::RenderWindow& window)
         {
             window.close();
         }
+        else if (const auto* buttonPressed = event->getIf<sf::Event::MouseButtonPressed>())
+        {
+            if (buttonPressed->button == sf::Mouse::Button::Left)
+            {
+                // every stroke can be undone on its own
+                history.checkpoint(grid);
+                const sf::Vector2i cell = toCell(buttonPressed->position);
+                brushStroke.begin(cell.y, cell.x);
+            }
+        }
+        else if (const auto* mouseMoved = event->getIf<sf::Event::MouseMoved>())
+        {
+            const sf::Vector2i cell = toCell(mouseMoved->position);
+            brushStroke.moveTo(cell.y, cell.x);
+        }
+        else if (const auto* buttonReleased = event->getIf<sf::Event::MouseButtonReleased>())
+        {
+            if (buttonReleased->button == sf::Mouse::Button::Left)
+            {
+                const sf::Vector2i cell = toCell(buttonReleased->position);
+                brushStroke.moveTo(cell.y, cell.x);
+                brushStroke.end();
+            }
+        }
         else if (const auto* keyPressed = event->getIf<sf::Event::KeyPressed>())
         {
             if (keyPressed->scancode >= sf::Keyboard::Scancode::Num1 && keyPressed->scancode <= sf::Keyboard::Scancode::Num9)
@@ -153,6 +288,14 @@ void Application::handleEvents(sf::RenderWindow& window)
             {
                 changeBrushSize(-1);
             }
+            else if (keyPressed->control && keyPressed->scancode == sf::Keyboard::Scancode::Z)
+            {
+                history.undo(grid);
+            }
+            else if (keyPressed->control && keyPressed->scancode == sf::Keyboard::Scancode::Y)
+            {
+                history.redo(grid);
+            }
         } 
     }
 }
@@ -162,13 +305,24 @@ void Application::run()
     sf::RenderWindow  window(sf::VideoMode({width, height}), "CellularAutomata");
     while(window.isOpen())
     {
+        if (configWatcher.poll())
+        {
+            reloadConfig();
+        }
+
         handleEvents(window);
 
         window.clear();
 
-        handleMouse(window);
+        handleMouse();
+        controlServer.applyCommands(grid);
 
-        grid.step();
+        grid.step(stepBudget);
+        if (checkpointInterval > 0 && grid.getTick() % checkpointInterval == 0)
+        {
+            history.checkpoint(grid);
+        }
+        controlServer.publishFrame(grid);
 
         drawGrid(window);
         drawInfo(window);
@@ -2,6 +2,10 @@
 #include <SFML/Graphics/Font.hpp>
 
 #include "core/CellGrid.h"
+#include "core/GridHistory.h"
+#include "input/BrushStroke.h"
+#include "input/ConfigWatcher.h"
+#include "ipc/ControlServer.h"
 
 namespace sf
 {
@@ -11,20 +15,27 @@ namespace sf
 class Application
 {
 public:
-    void load();
+    bool load();
     void run();
 private:
     CellGrid grid {};
+    GridHistory history;
+    int checkpointInterval = 0;
     int pixelSize =  0;
     unsigned width = 0;
     unsigned height = 0;
     sf::Font font;
+    ConfigWatcher configWatcher;
+    StepBudget stepBudget;
+    ControlServer controlServer;
 
     int brushSize = 1;
+    BrushStroke brushStroke;
 
     int activeMatter = 0;
     std::vector<std::string> matterNames;
 
+    void reloadConfig();
     void tryChangeActiveMatter(int newActiveMatter);
 
     const std::string& getActiveMatterName() const;
@@ -35,6 +46,7 @@ private:
     
     void drawGrid(sf::RenderWindow& window);
     void drawInfo(sf::RenderWindow& window);
-    void handleMouse(sf::RenderWindow& window);
+    sf::Vector2i toCell(sf::Vector2i position) const;
+    void handleMouse();
     void handleEvents(sf::RenderWindow& window);
 };
@@ -0,0 +1,433 @@
+﻿#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <tuple>
+
+#include "core/CellGrid.h"
+#include "core/Ensemble.h"
+#include "core/GridLayout.h"
+#include "input/Parser.h"
+#include "utils/MemoryUsage.h"
+#include "utils/PerfCounter.h"
+
+namespace Bench
+{
+    constexpr int gridWidth = 512;
+    constexpr int gridHeight = 256;
+    constexpr int ticks = 400;
+
+    constexpr int worldSize = 32;
+    constexpr int worldCount = 1024;
+    constexpr int worldTicks = 500;
+    // rows of the summary that are printed, spread evenly over the sweep
+    constexpr int printedWorlds = 8;
+
+    // wide enough for a row of cells to be far apart from the next one
+    constexpr int layoutWidth = 1024;
+    constexpr int layoutHeight = 512;
+    constexpr int layoutTicks = 60;
+
+    constexpr int traceTicks = 300;
+
+    // a large map that is mostly at rest, with a single tank of liquid sloshing in one corner
+    constexpr int staticWidth = 2048;
+    constexpr int staticHeight = 1024;
+    constexpr int staticTicks = 300;
+    constexpr int staticSleepTicks = 60;
+
+    // FNV-1a over the matter and the inertia of every cell
+    template <typename Layout>
+    uint64_t hashGrid(const BasicCellGrid<Layout>& grid)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (int r = 0; r < grid.getHeight(); ++r)
+        {
+            for (int c = 0; c < grid.getWidth(); ++c)
+            {
+                const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+                const uint32_t value = cell ? (static_cast<uint32_t>(cell->getTraits().material) << 2) + (cell->getInertia() + 1) : NoMaterial;
+                hash = (hash ^ value) * 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+}
+
+bool Benchmark::load()
+{
+    Parser parser = Parser();
+    if (!parser.parse())
+    {
+        for (const ParseError& error : parser.getErrors())
+        {
+            std::cerr << error.file << ':' << error.line << ':' << error.column << ": error: " << error.message << std::endl;
+        }
+        return false;
+    }
+
+    cells = parser.getCells();
+    std::tie(domainRows, domainColumns) = parser.getDomains();
+    threadCount = parser.getThreadCount();
+    pinThreads = parser.getPinThreads();
+    deterministic = parser.getDeterministic();
+    return true;
+}
+
+void Benchmark::run()
+{
+    std::printf("%dx%d cells, %d ticks, %dx%d domains, %d threads\n", Bench::gridWidth, Bench::gridHeight, Bench::ticks,
+        domainRows, domainColumns, threadCount);
+    std::printf("%-12s %-10s %12s %12s %14s %14s\n", "scenario", "engine", "ms/tick", "ticks/s", "cells/tick", "Mcells/s");
+    for (Scenario scenario : {Scenario::SandPile, Scenario::WaterTank, Scenario::Mixed})
+    {
+        for (SimulationEngine engine : {SimulationEngine::Queue, SimulationEngine::Margolus})
+        {
+            runScenario(scenario, engine);
+        }
+    }
+
+    std::printf("\nmostly static %dx%d world, %d ticks, chunks compressed after %d ticks asleep\n", Bench::staticWidth, Bench::staticHeight,
+        Bench::staticTicks, Bench::staticSleepTicks);
+    std::printf("%-12s %12s %12s %12s\n", "compression", "resident MB", "compressed", "ms/tick");
+    runCompression(false);
+    runCompression(true);
+
+    for (SimulationEngine engine : {SimulationEngine::Queue, SimulationEngine::Margolus})
+    {
+        runEnsemble(engine);
+    }
+}
+
+void Benchmark::runLayouts()
+{
+    PerfCounter counter;
+    // a single thread steps the grid, so the counter sees every miss
+    std::printf("%dx%d cells, %d ticks on one thread, cache misses %s\n", Bench::layoutWidth, Bench::layoutHeight, Bench::layoutTicks,
+        counter.isAvailable() ? "counted" : "not available");
+    std::printf("%-12s %-12s %10s %14s %14s   %s\n", "scenario", "layout", "ms/tick", "cells/tick", "misses/cell", "world");
+    for (Scenario scenario : {Scenario::SandPile, Scenario::WaterTank, Scenario::Mixed})
+    {
+        // the first layout of the list is the reference the others are compared to
+        uint64_t reference = 0;
+#define RUN_LAYOUT(Layout) \
+        { \
+            const uint64_t hash = runLayout<Layout>(scenario, counter, reference); \
+            reference = reference == 0 ? hash : reference; \
+        }
+        GRID_LAYOUTS(RUN_LAYOUT)
+#undef RUN_LAYOUT
+    }
+}
+
+template <typename Layout>
+uint64_t Benchmark::runLayout(Scenario scenario, PerfCounter& counter, uint64_t reference)
+{
+    BasicCellGrid<Layout> grid;
+    grid.initialize(Bench::layoutWidth, Bench::layoutHeight);
+    grid.loadCellTypes(cells);
+    fillScenario(grid, scenario);
+    // the fill made the cells row after row, here they follow the layout on the heap as well
+    grid.compactCells();
+
+    double cellUpdates = 0.0;
+    uint64_t misses = 0;
+    std::chrono::duration<double> elapsed {0.0};
+    for (int i = 0; i < Bench::layoutTicks; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        counter.start();
+        grid.step();
+        misses += counter.stop();
+        elapsed += std::chrono::steady_clock::now() - start;
+        cellUpdates += grid.getUpdatedCount();
+    }
+
+    const uint64_t hash = Bench::hashGrid(grid);
+    std::printf("%-12s %-12s %10.3f %14.0f", getName(scenario), Layout::name, elapsed.count() * 1000.0 / Bench::layoutTicks,
+        cellUpdates / Bench::layoutTicks);
+    if (counter.isAvailable())
+    {
+        std::printf(" %14.3f", misses / std::max(cellUpdates, 1.0));
+    }
+    else
+    {
+        std::printf(" %14s", "-");
+    }
+    // every layout has to end up with the same world as row-major
+    std::printf("   %s\n", reference == 0 ? "reference" : hash == reference ? "same" : "differs");
+    return hash;
+}
+
+bool Benchmark::runDeterminism()
+{
+    // the split from the config and a few others, all of them have to match 1x1 on a single thread tick by tick
+    const int splits[][3] = {{domainRows, domainColumns, threadCount}, {1, 2, 2}, {2, 2, 4}, {3, 5, 4}, {8, 8, 8}};
+    std::printf("%dx%d cells, %d ticks in deterministic mode, compared to 1x1 on one thread\n", Bench::gridWidth, Bench::gridHeight, Bench::traceTicks);
+    std::printf("%-12s %-10s %8s   %s\n", "scenario", "domains", "threads", "result");
+
+    bool identical = true;
+    for (Scenario scenario : {Scenario::SandPile, Scenario::WaterTank, Scenario::Mixed, Scenario::Sediment})
+    {
+        const std::vector<uint64_t> reference = traceScenario(scenario, 1, 1, 1);
+        for (const int* split : splits)
+        {
+            const std::vector<uint64_t> trace = traceScenario(scenario, split[0], split[1], split[2]);
+            const auto mismatch = std::mismatch(reference.begin(), reference.end(), trace.begin());
+            const std::string domains = std::to_string(split[0]) + "x" + std::to_string(split[1]);
+            if (mismatch.first == reference.end())
+            {
+                std::printf("%-12s %-10s %8d   identical\n", getName(scenario), domains.c_str(), split[2]);
+            }
+            else
+            {
+                std::printf("%-12s %-10s %8d   differs from tick %d\n", getName(scenario), domains.c_str(), split[2],
+                    static_cast<int>(mismatch.first - reference.begin()) + 1);
+                identical = false;
+            }
+        }
+    }
+    return identical;
+}
+
+std::vector<uint64_t> Benchmark::traceScenario(Scenario scenario, int splitRows, int splitColumns, int splitThreads) const
+{
+    CellGrid grid;
+    grid.initialize(Bench::gridWidth, Bench::gridHeight);
+    grid.loadCellTypes(cells);
+    grid.setDomains(splitRows, splitColumns, splitThreads, pinThreads, true);
+    // the sediment is the scenario that also runs the liquid solver
+    grid.setLiquidLevelling(scenario == Scenario::Sediment);
+    fillScenario(grid, scenario);
+
+    std::vector<uint64_t> trace;
+    trace.reserve(Bench::traceTicks);
+    for (int i = 0; i < Bench::traceTicks; ++i)
+    {
+        grid.step();
+        trace.push_back(Bench::hashGrid(grid));
+    }
+    return trace;
+}
+
+void Benchmark::runScenario(Scenario scenario, SimulationEngine engine)
+{
+    CellGrid grid;
+    grid.initialize(Bench::gridWidth, Bench::gridHeight);
+    grid.loadCellTypes(cells);
+    grid.setDomains(domainRows, domainColumns, threadCount, pinThreads, deterministic);
+    grid.setEngine(engine);
+    fillScenario(grid, scenario);
+
+    // the queue engine only steps the pending cells while the Margolus engine goes over all of them,
+    // so the throughput is counted in the cells each of them actually updated
+    double cellUpdates = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Bench::ticks; ++i)
+    {
+        grid.step();
+        cellUpdates += grid.getUpdatedCount();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const double seconds = elapsed.count();
+    std::printf("%-12s %-10s %12.3f %12.1f %14.0f %14.1f\n", getName(scenario), getName(engine),
+        seconds * 1000.0 / Bench::ticks, Bench::ticks / seconds, cellUpdates / Bench::ticks, cellUpdates / seconds / 1e6);
+}
+
+void Benchmark::runCompression(bool compress)
+{
+    const size_t residentBefore = getResidentBytes();
+    CellGrid grid;
+    grid.initialize(Bench::staticWidth, Bench::staticHeight);
+    grid.loadCellTypes(cells);
+    grid.setDomains(domainRows, domainColumns, threadCount, pinThreads, deterministic);
+    grid.setChunkCompression(compress ? Bench::staticSleepTicks : 0);
+
+    // bands of solid and grain resting on each other fill the lower three quarters
+    const MaterialId solid = findMatter(grid, CellType::Solid);
+    const MaterialId grain = findMatter(grid, CellType::Grain);
+    const MaterialId liquid = findMatter(grid, CellType::Liquid);
+    GridEdit bands[2] = {{solid, {}}, {grain, {}}};
+    for (int r = Bench::staticHeight / 4; r < Bench::staticHeight; ++r)
+    {
+        bands[(r / 16) % 2 == 0 || r == Bench::staticHeight - 1 ? 0 : 1].spans.push_back({r, 0, Bench::staticWidth});
+    }
+    GridEdit tank {liquid, {}};
+    for (int r = 0; r < Bench::staticHeight / 8; ++r)
+    {
+        tank.spans.push_back({r, 0, Bench::staticWidth / 16});
+    }
+    grid.applyEdit(bands[0]);
+    grid.applyEdit(bands[1]);
+    grid.applyEdit(tank);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Bench::staticTicks; ++i)
+    {
+        grid.step();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const size_t residentAfter = getResidentBytes();
+    const double resident = residentAfter > residentBefore ? (residentAfter - residentBefore) / (1024.0 * 1024.0) : 0.0;
+    std::printf("%-12s %12.1f %12d %12.3f\n", compress ? "on" : "off", resident, grid.getCompressedChunkCount(),
+        elapsed.count() * 1000.0 / Bench::staticTicks);
+}
+
+void Benchmark::runEnsemble(SimulationEngine engine)
+{
+    auto grainIt = std::find_if(cells.begin(), cells.end(), [](const CellTraits& traits) { return traits.type == CellType::Grain; });
+    if (grainIt == cells.end())
+    {
+        return;
+    }
+    const size_t grainIndex = grainIt - cells.begin();
+
+    Ensemble ensemble(Bench::worldSize, Bench::worldSize, threadCount, pinThreads);
+    ensemble.reserve(Bench::worldCount);
+    for (int i = 0; i < Bench::worldCount; ++i)
+    {
+        // the grain goes from a quarter to twice its density in the config
+        std::vector<CellTraits> variant = cells;
+        variant[grainIndex].density = std::max(1, cells[grainIndex].density * (i + Bench::worldCount / 7) * 2 / (Bench::worldCount + Bench::worldCount / 7));
+        ensemble.addWorld(variant, static_cast<uint32_t>(i) * 2654435761u);
+    }
+
+    ensemble.populate([this, engine](CellGrid& grid, uint32_t seed)
+    {
+        grid.setEngine(engine);
+        grid.setLiquidLevelling(true);
+        fillScenario(grid, Scenario::Sediment, seed);
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    ensemble.run(Bench::worldTicks);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int settled = 0;
+    double settleTicks = 0.0;
+    for (int i = 0; i < ensemble.getWorldCount(); ++i)
+    {
+        const WorldSummary& summary = ensemble.getSummary(i);
+        if (summary.settled)
+        {
+            ++settled;
+            settleTicks += static_cast<double>(summary.settleTick);
+        }
+    }
+
+    std::printf("\nensemble of %d %dx%d worlds on the %s engine, at most %d ticks\n", Bench::worldCount, Bench::worldSize, Bench::worldSize,
+        getName(engine), Bench::worldTicks);
+    std::printf("%.0f world-frames/s, %d worlds settled after %.1f ticks on average\n",
+        ensemble.getWorldFrames() / elapsed.count(), settled, settled > 0 ? settleTicks / settled : 0.0);
+
+    const MaterialId grain = ensemble.getWorld(0).getMaterialId(grainIt->name);
+    std::printf("%-8s %-10s %-12s\n", "world", "density", "grain row");
+    for (int i = 0; i < Bench::worldCount; i += Bench::worldCount / Bench::printedWorlds)
+    {
+        std::printf("%-8d %-10d %-12.2f\n", i, ensemble.getWorld(i).getCellDefault(grain)->getTraits().density, ensemble.getSummary(i).meanRows[grain]);
+    }
+}
+
+template <typename Grid>
+void Benchmark::fillScenario(Grid& grid, Scenario scenario, uint32_t seed) const
+{
+    const MaterialId solid = findMatter(grid, CellType::Solid);
+    const MaterialId grain = findMatter(grid, CellType::Grain);
+    const MaterialId liquid = findMatter(grid, CellType::Liquid);
+    const MaterialId gas = findMatter(grid, CellType::Gas);
+    const int w = grid.getWidth();
+    const int h = grid.getHeight();
+
+    GridEdit floor {solid, {{h - 1, 0, w}}};
+    grid.applyEdit(floor);
+
+    switch (scenario)
+    {
+        case Scenario::SandPile:
+        {
+            // a block of grain dropped in the middle
+            GridEdit pile {grain, {}};
+            for (int r = 0; r < h / 3; ++r)
+            {
+                pile.spans.push_back({r, w / 3, 2 * w / 3});
+            }
+            grid.applyEdit(pile);
+            break;
+        }
+        case Scenario::WaterTank:
+        {
+            // a tank of liquid against the left wall that is let loose at once
+            GridEdit tank {liquid, {}};
+            for (int r = h / 4; r < h - 1; ++r)
+            {
+                tank.spans.push_back({r, 0, w / 4});
+            }
+            grid.applyEdit(tank);
+            break;
+        }
+        case Scenario::Mixed:
+        case Scenario::Sediment:
+        {
+            // matters scattered over the upper half, the same pattern for the same seed
+            const MaterialId matters[] = {solid, grain, liquid, scenario == Scenario::Mixed ? gas : NoMaterial, NoMaterial};
+            for (int r = 0; r < h / 2; ++r)
+            {
+                for (int c = 0; c < w; ++c)
+                {
+                    seed = seed * 1664525u + 1013904223u;
+                    const MaterialId material = matters[(seed >> 24) % 5];
+                    if (material != NoMaterial)
+                    {
+                        grid.createCell(r, c, material);
+                    }
+                }
+            }
+            break;
+        }
+    }
+}
+
+template <typename Grid>
+MaterialId Benchmark::findMatter(const Grid& grid, CellType type) const
+{
+    for (const CellTraits& traits : cells)
+    {
+        if (traits.type == type)
+        {
+            return grid.getMaterialId(traits.name);
+        }
+    }
+    return NoMaterial;
+}
+
+const char* Benchmark::getName(Scenario scenario)
+{
+    switch (scenario)
+    {
+        case Scenario::SandPile:
+            return "sand pile";
+        case Scenario::WaterTank:
+            return "water tank";
+        case Scenario::Mixed:
+            return "mixed";
+        case Scenario::Sediment:
+            return "sediment";
+    }
+    return "";
+}
+
+const char* Benchmark::getName(SimulationEngine engine)
+{
+    switch (engine)
+    {
+        case SimulationEngine::Queue:
+            return "queue";
+        case SimulationEngine::Margolus:
+            return "margolus";
+    }
+    return "";
+}
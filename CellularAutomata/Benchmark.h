@@ -0,0 +1,58 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/Cell.h"
+#include "core/CellGridFwd.h"
+
+class PerfCounter;
+
+// Headless runs of fixed scenarios that print the throughput of both engines side by side,
+// the memory a mostly static world takes with and without chunk compression
+// and an ensemble of small worlds sweeping the grain density.
+// Started with --bench, matters and the domain setup are taken from the config.
+// --bench layouts instead steps the grid built with each of the memory layouts.
+// --bench determinism checks that deterministic mode gives the same world for every split as for 1x1
+class Benchmark
+{
+public:
+    bool load();
+    void run();
+    void runLayouts();
+    // false if any split went its own way
+    bool runDeterminism();
+private:
+    enum class Scenario
+    {
+        SandPile,
+        WaterTank,
+        Mixed,
+        // grain and liquid without gas, a world that can come to rest
+        Sediment
+    };
+
+    std::vector<CellTraits> cells;
+    int domainRows = 1;
+    int domainColumns = 1;
+    int threadCount = 1;
+    bool pinThreads = false;
+    bool deterministic = false;
+
+    void runScenario(Scenario scenario, SimulationEngine engine);
+    void runEnsemble(SimulationEngine engine);
+    void runCompression(bool compress);
+    // returns the hash of the world at the end, reference is the one of row-major or 0 for row-major itself
+    template <typename Layout>
+    uint64_t runLayout(Scenario scenario, PerfCounter& counter, uint64_t reference);
+    // hash of the world after every tick
+    std::vector<uint64_t> traceScenario(Scenario scenario, int splitRows, int splitColumns, int splitThreads) const;
+    // for a grid of any layout
+    template <typename Grid>
+    void fillScenario(Grid& grid, Scenario scenario, uint32_t seed = 12345) const;
+    template <typename Grid>
+    MaterialId findMatter(const Grid& grid, CellType type) const;
+
+    static const char* getName(Scenario scenario);
+    static const char* getName(SimulationEngine engine);
+};
@@ -1,8 +1,47 @@
 #include "Application.h"
+#include "Benchmark.h"
+#include "ipc/ControlDriver.h"
 
-int main()
+#include <string_view>
+
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string_view(argv[1]) == "--bench")
+    {
+        Benchmark benchmark = Benchmark();
+        if (!benchmark.load())
+        {
+            return 1;
+        }
+        if (argc > 2 && std::string_view(argv[2]) == "layouts")
+        {
+            benchmark.runLayouts();
+        }
+        else if (argc > 2 && std::string_view(argv[2]) == "determinism")
+        {
+            return benchmark.runDeterminism() ? 0 : 1;
+        }
+        else
+        {
+            benchmark.run();
+        }
+        return 0;
+    }
+
+    if (argc > 2 && std::string_view(argv[1]) == "--drive")
+    {
+        ControlDriver driver = ControlDriver();
+        if (!driver.connect(argv[2]))
+        {
+            return 1;
+        }
+        return driver.run() ? 0 : 1;
+    }
+
     Application app = Application();
-    app.load();
+    if (!app.load())
+    {
+        return 1;
+    }
     app.run();
 }
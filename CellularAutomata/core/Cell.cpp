@@ -1,8 +1,24 @@
 ﻿#include "Cell.h"
 
-#include "CellGrid.h"
+#include "CellArena.h"
 #include "CoreTypes.h"
+#include "GridAccess.h"
 
+void* Cell::operator new(size_t size)
+{
+    CellArena* arena = CellArena::getActive();
+    void* pointer = arena != nullptr ? arena->allocate(size) : nullptr;
+    return pointer != nullptr ? pointer : ::operator new(size);
+}
+
+void Cell::operator delete(void* pointer, size_t size)
+{
+    CellArena* arena = CellArena::getActive();
+    if (arena == nullptr || !arena->release(pointer))
+    {
+        ::operator delete(pointer, size);
+    }
+}
 
 void Cell::load(const CellTraits& inTraits)
 {
@@ -30,12 +46,17 @@ const int Cell::getInertia() const
     return inertia;
 }
 
+void Cell::setInertia(int inInertia)
+{
+    inertia = inInertia;
+}
+
 Cell* SolidCell::cloneImpl() const
 {
     return new SolidCell(*this);
 }
 
-void SolidCell::step(CellGrid* inGrid)
+void SolidCell::step(GridAccess* inGrid)
 {
 }
 
@@ -44,12 +65,12 @@ Cell* GrainCell::cloneImpl() const
     return new GrainCell(*this);
 }
 
-bool GrainCell::isFreeHorizontally(const CellGrid* inGrid, int dir) const
+bool GrainCell::isFreeHorizontally(const GridAccess* inGrid, int dir) const
 {
     return !inGrid->getCell(row, column + dir) || inGrid->getCell(row, column + dir)->getTraits().type != CellType::Solid;
 }
 
-void GrainCell::step(CellGrid* inGrid)
+void GrainCell::step(GridAccess* inGrid)
 {
     constexpr int dirs[3][2] = {{1, 0}, {1, 1}, {1, -1}};
     for (const auto dir : dirs)
@@ -85,7 +106,7 @@ Cell* LiquidCell::cloneImpl() const
     return new LiquidCell(*this);
 }
 
-void LiquidCell::step(CellGrid* inGrid)
+void LiquidCell::step(GridAccess* inGrid)
 {
     constexpr int dirs[3][2] = {{1, 0}, {1, 1}, {1, -1}};
     for (const auto dir : dirs)
@@ -124,7 +145,15 @@ void LiquidCell::step(CellGrid* inGrid)
         if (newCellType == getTraits().type)
         {
             inertia = inGrid->getCell(row, newColumn)->getInertia();
-            inGrid->addPendingCell(row, column);
+            if (inGrid->isLiquidLevelling() && getTraits().type == CellType::Liquid)
+            {
+                // the solver levels the whole body, so the cell can rest instead of walking over it
+                inGrid->addSettledLiquid(row, column);
+            }
+            else
+            {
+                inGrid->addPendingCell(row, column);
+            }
         }
         else
         {
@@ -2,8 +2,9 @@
 #include <memory>
 #include <string>
 
-class CellGrid;
-enum class CellType : uint8_t;
+#include "CoreTypes.h"
+
+class GridAccess;
 
 struct CellTraits
 {
@@ -11,6 +12,8 @@ struct CellTraits
     CellType type;
     int density;
     int color[3]; 
+    // assigned by the grid when the matter is loaded
+    MaterialId material = NoMaterial;
 };
 
 class Cell
@@ -22,14 +25,19 @@ public:
     Cell& operator=(const Cell& other) = default;
     Cell& operator=(Cell&& other) noexcept = default;
     virtual ~Cell() = default;
+
+    // cells are made in the CellArena active on the thread if there is one
+    static void* operator new(size_t size);
+    static void operator delete(void* pointer, size_t size);
     
     virtual void load(const CellTraits& inTraits);
     virtual void updatePosition(int r, int c);
-    virtual void step(CellGrid* inGrid) = 0;
+    virtual void step(GridAccess* inGrid) = 0;
     
     std::unique_ptr<Cell> clone() const;
     const CellTraits& getTraits() const;
     const int getInertia() const;
+    void setInertia(int inInertia);
 
 protected:
     virtual Cell* cloneImpl() const = 0;
@@ -46,7 +54,7 @@ protected:
 class SolidCell : public Cell
 {
 public:
-    virtual void step(CellGrid* inGrid) override;
+    virtual void step(GridAccess* inGrid) override;
     
 protected:
     virtual Cell* cloneImpl() const override;
@@ -55,17 +63,17 @@ protected:
 class GrainCell : public Cell
 {
 public:
-    virtual void step(CellGrid* inGrid) override;
+    virtual void step(GridAccess* inGrid) override;
     
 protected:
     virtual Cell* cloneImpl() const override;
-    bool isFreeHorizontally(const CellGrid* inGrid, int dir) const;
+    bool isFreeHorizontally(const GridAccess* inGrid, int dir) const;
 };
 
 class LiquidCell : public Cell
 {
 public:
-    virtual void step(CellGrid* inGrid) override;
+    virtual void step(GridAccess* inGrid) override;
 protected:
     int gravity = 1; 
     virtual Cell* cloneImpl() const override;
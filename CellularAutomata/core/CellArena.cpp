@@ -0,0 +1,84 @@
+﻿#include "CellArena.h"
+
+#include <utility>
+
+thread_local CellArena* CellArena::active = nullptr;
+
+CellArena::CellArena(size_t inSlotCount)
+    : slots(std::make_unique<Slot[]>(inSlotCount)), slotCount(inSlotCount)
+{
+}
+
+CellArena::CellArena(CellArena&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+CellArena& CellArena::operator=(CellArena&& other) noexcept
+{
+    slots = std::move(other.slots);
+    slotCount = std::exchange(other.slotCount, 0);
+    firstUnused = std::exchange(other.firstUnused, 0);
+    freeSlots = std::exchange(other.freeSlots, nullptr);
+    usedCount = std::exchange(other.usedCount, 0);
+    return *this;
+}
+
+void* CellArena::allocate(size_t size)
+{
+    if (size > sizeof(Slot))
+    {
+        return nullptr;
+    }
+
+    Slot* slot = nullptr;
+    if (freeSlots != nullptr)
+    {
+        slot = freeSlots;
+        freeSlots = slot->next;
+    }
+    else if (firstUnused < slotCount)
+    {
+        slot = &slots[firstUnused++];
+    }
+    else
+    {
+        return nullptr;
+    }
+    ++usedCount;
+    return slot;
+}
+
+bool CellArena::release(void* pointer)
+{
+    Slot* slot = static_cast<Slot*>(pointer);
+    if (!slots || slot < slots.get() || slot >= slots.get() + slotCount)
+    {
+        return false;
+    }
+    slot->next = freeSlots;
+    freeSlots = slot;
+    --usedCount;
+    return true;
+}
+
+size_t CellArena::getUsedCount() const
+{
+    return usedCount;
+}
+
+CellArena* CellArena::getActive()
+{
+    return active;
+}
+
+CellArena::Scope::Scope(CellArena& arena)
+    : previous(active)
+{
+    active = &arena;
+}
+
+CellArena::Scope::~Scope()
+{
+    active = previous;
+}
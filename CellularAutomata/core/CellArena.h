@@ -0,0 +1,58 @@
+﻿#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+#include "Cell.h"
+
+// One block of equal slots for the Cell objects of a grid, so the cells of a small world lie next to each other
+// instead of between the cells of all the other worlds. Cells are made in the arena that is active on the thread
+// and come from the heap without one or once the arena is full. A grid whose cells are in an arena
+// has to be used with the arena active and from one thread at a time, that is how a cell gets back into its slot
+class CellArena
+{
+public:
+    CellArena() = default;
+    explicit CellArena(size_t slotCount);
+    CellArena(CellArena&& other) noexcept;
+    CellArena& operator=(CellArena&& other) noexcept;
+    CellArena(const CellArena& other) = delete;
+    CellArena& operator=(const CellArena& other) = delete;
+
+    // nullptr when the arena is full or the size is not of a cell
+    void* allocate(size_t size);
+    // false if the memory is not from this arena
+    bool release(void* pointer);
+    size_t getUsedCount() const;
+
+    static CellArena* getActive();
+
+    // the arena is active on the thread for as long as the scope lives
+    class Scope
+    {
+    public:
+        explicit Scope(CellArena& arena);
+        ~Scope();
+        Scope(const Scope& other) = delete;
+        Scope& operator=(const Scope& other) = delete;
+
+    private:
+        CellArena* previous = nullptr;
+    };
+
+private:
+    union Slot
+    {
+        Slot* next;
+        alignas(std::max_align_t) unsigned char bytes[std::max({sizeof(SolidCell), sizeof(GrainCell), sizeof(LiquidCell), sizeof(GasCell)})];
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t slotCount = 0;
+    // slots below it have been handed out at least once, the released ones are chained from freeSlots
+    size_t firstUnused = 0;
+    Slot* freeSlots = nullptr;
+    size_t usedCount = 0;
+
+    static thread_local CellArena* active;
+};
@@ -1,149 +1,865 @@
 ﻿#include "CellGrid.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <iterator>
 #include <ostream>
 
 #include "CoreTypes.h"
+#include "MargolusRules.h"
+#include "../utils/ThreadPool.h"
 
-CellGrid::~CellGrid()
+namespace
+{
+    const std::unique_ptr<Cell> noCell = nullptr;
+
+    // the domain the current thread is stepping, pending cells outside of it go to its halo
+    thread_local GridDomain* activeDomain = nullptr;
+
+    // sleeping chunks are looked for this often, not on every step
+    constexpr uint64_t compressionInterval = 32;
+
+    const MargolusRules margolusRules;
+}
+
+template <typename Layout>
+BasicCellGrid<Layout>::BasicCellGrid()
+{
+    buildDomains(1, 1);
+}
+
+template <typename Layout>
+BasicCellGrid<Layout>::~BasicCellGrid()
 {
     resetCellDefaults();
 }
 
-void CellGrid::initialize(int w, int h)
+template <typename Layout>
+BasicCellGrid<Layout>::BasicCellGrid(BasicCellGrid&& other) = default;
+
+template <typename Layout>
+BasicCellGrid<Layout>& BasicCellGrid<Layout>::operator=(BasicCellGrid&& other) = default;
+
+template <typename Layout>
+void BasicCellGrid<Layout>::initialize(int w, int h)
 {
     width = w;
     heigth = h;
-    grid = GridType(h);
-    for (int r = 0; r < h; ++r)
+    grid.resize(w, h);
+    chunkRows = (h + ChunkSize - 1) / ChunkSize;
+    chunkColumns = (w + ChunkSize - 1) / ChunkSize;
+    storages = std::vector<ChunkStorage>(chunkRows * chunkColumns);
+    changedChunks.assign(chunkRows * chunkColumns, 0);
+    rebuildChunks();
+    buildDomains(1, 1);
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::setDomains(int domainRows, int domainColumns, int threadCount, bool pinThreads, bool inDeterministic)
+{
+    // keep what is already pending, in the order of the old domains with the deferred updates first
+    std::vector<int> pending;
+    for (GridDomain& domain : domains)
     {
-        grid[r] = std::vector<std::unique_ptr<Cell>>(w);
+        pending.insert(pending.end(), domain.deferredUpdates.begin(), domain.deferredUpdates.end());
+        while (!domain.pendingUpdates.empty())
+        {
+            pending.push_back(domain.pendingUpdates.front());
+            domain.pendingUpdates.pop();
+        }
+    }
+
+    deterministic = inDeterministic;
+    buildDomains(domainRows, domainColumns);
+    for (int index : pending)
+    {
+        domains[getDomainIndex(index / width, index % width)].pendingUpdates.push(index);
+    }
+
+    threadPool.reset();
+    if (threadCount > 1 && domains.size() > 1)
+    {
+        threadPool = std::make_unique<ThreadPool>(threadCount - 1, pinThreads);
     }
 }
 
-void CellGrid::loadCellTypes(const std::vector<CellTraits>& cellTraits)
+template <typename Layout>
+void BasicCellGrid<Layout>::setLiquidLevelling(bool enabled)
 {
-    resetCellDefaults();
-    for (auto& cellTrait : cellTraits)
+    liquidLevelling = enabled;
+}
+
+template <typename Layout>
+bool BasicCellGrid<Layout>::isLiquidLevelling() const
+{
+    return liquidLevelling;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::setEngine(SimulationEngine newEngine)
+{
+    if (newEngine == engine)
+    {
+        return;
+    }
+    engine = newEngine;
+    // the blocks of the Margolus engine go over every cell, there is nothing left to sleep
+    wakeAllChunks();
+
+    for (GridDomain& domain : domains)
+    {
+        domain.pendingUpdates.clear();
+        domain.deferredUpdates.clear();
+        domain.settledLiquids.clear();
+    }
+    if (engine == SimulationEngine::Queue)
     {
-        if (cellDefaults.find(cellTrait.name) == cellDefaults.end())
+        for (int r = 0; r < heigth; ++r)
         {
-            addCellDefault(cellTrait);
+            for (int c = 0; c < width; ++c)
+            {
+                addPendingCell(r, c);
+            }
         }
     }
 }
 
-void CellGrid::createCell(int r, int c, const std::string& cellName)
+template <typename Layout>
+SimulationEngine BasicCellGrid<Layout>::getEngine() const
+{
+    return engine;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::setChunkCompression(int sleepTicks)
+{
+    chunkSleepTicks = std::max(0, sleepTicks);
+    if (chunkSleepTicks == 0)
+    {
+        wakeAllChunks();
+    }
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getCompressedChunkCount() const
 {
-    if (cellDefaults.find(cellName) == cellDefaults.end() || r < 0 || c < 0 || r >= heigth || c >= width)
+    int count = 0;
+    for (const ChunkStorage& storage : storages)
+    {
+        count += storage.compressed ? 1 : 0;
+    }
+    return count;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::loadCellTypes(const std::vector<CellTraits>& cellTraits)
+{
+    wakeAllChunks();
+    addCellDefaults(cellTraits);
+    rebuildChunks();
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::reloadCellTypes(const std::vector<CellTraits>& cellTraits)
+{
+    wakeAllChunks();
+    std::vector<std::unique_ptr<Cell>> oldDefaults = std::move(cellDefaults);
+    addCellDefaults(cellTraits);
+
+    std::vector<MaterialId> remap(oldDefaults.size(), NoMaterial);
+    for (size_t i = 0; i < oldDefaults.size(); ++i)
+    {
+        remap[i] = getMaterialId(oldDefaults[i]->getTraits().name);
+    }
+
+    for (int r = 0; r < heigth; ++r)
+    {
+        for (int c = 0; c < width; ++c)
+        {
+            std::unique_ptr<Cell>& cell = grid(r, c);
+            if (!cell)
+            {
+                continue;
+            }
+
+            const CellType oldType = cell->getTraits().type;
+            const int oldDensity = cell->getTraits().density;
+            const MaterialId newMaterial = remap[cell->getTraits().material];
+            if (newMaterial == NoMaterial)
+            {
+                cell.reset();
+                propagateDormancy(r, c);
+                continue;
+            }
+
+            const CellTraits& newTraits = cellDefaults[newMaterial]->getTraits();
+            if (newTraits.type != oldType)
+            {
+                cell = cellDefaults[newMaterial]->clone();
+                cell->updatePosition(r, c);
+            }
+            else
+            {
+                cell->load(newTraits);
+            }
+
+            // only changes that affect movement need to wake the cell, colors are picked up on the next draw
+            if (newTraits.type != oldType || newTraits.density != oldDensity)
+            {
+                addPendingCell(r, c);
+            }
+        }
+    }
+    rebuildChunks();
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::createCell(int r, int c, const std::string& cellName)
+{
+    createCell(r, c, getMaterialId(cellName));
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::createCell(int r, int c, MaterialId material)
+{
+    if (material >= cellDefaults.size() || r < 0 || c < 0 || r >= heigth || c >= width)
     {
         return;
     }
-    grid[r][c] = cellDefaults[cellName]->clone();
-    grid[r][c]->updatePosition(r, c);
+    wakeCell(r, c);
+    trackCell(r, c, grid(r, c), -1);
+    grid(r, c) = cellDefaults[material]->clone();
+    grid(r, c)->updatePosition(r, c);
+    trackCell(r, c, grid(r, c), 1);
 
     addPendingCell(r, c);
 }
 
-void CellGrid::step()
+template <typename Layout>
+void BasicCellGrid<Layout>::clearCell(int r, int c)
 {
-    UniqueQueue<int> localUpdates = pendingUpdates;
-    pendingUpdates.clear();
+    if (!isValidCell(r, c))
+    {
+        return;
+    }
+    wakeCell(r, c);
+    trackCell(r, c, grid(r, c), -1);
+    grid(r, c).reset();
+    // whatever rested on the cell has to notice it is gone
+    propagateDormancy(r, c);
+}
 
+template <typename Layout>
+void BasicCellGrid<Layout>::applyEdit(const GridEdit& edit)
+{
+    if (edit.material != NoMaterial && edit.material >= cellDefaults.size())
+    {
+        return;
+    }
 
-    while (!localUpdates.empty())
+    for (const CellSpan& span : edit.spans)
     {
-        const int updateIndex = localUpdates.front();
-        localUpdates.pop();
-        performCellUpdate(updateIndex);
+        if (span.row < 0 || span.row >= heigth)
+        {
+            continue;
+        }
+
+        const int end = std::min(span.end, width);
+        for (int c = std::max(span.begin, 0); c < end; ++c)
+        {
+            const std::unique_ptr<Cell>& cell = getCell(span.row, c);
+            const MaterialId material = cell ? cell->getTraits().material : NoMaterial;
+            if (material == edit.material)
+            {
+                continue;
+            }
+
+            if (edit.material == NoMaterial)
+            {
+                clearCell(span.row, c);
+            }
+            else
+            {
+                createCell(span.row, c, edit.material);
+            }
+        }
     }
+}
 
+template <typename Layout>
+void BasicCellGrid<Layout>::step()
+{
+    step(StepBudget());
 }
 
-const std::unique_ptr<Cell>& CellGrid::getCell(int r, int c) const
+template <typename Layout>
+void BasicCellGrid<Layout>::step(const StepBudget& budget)
+{
+    ++tick;
+    for (GridDomain& domain : domains)
+    {
+        domain.updatedCells = 0;
+        domain.verticalMoves = 0;
+    }
+    if (chunkSleepTicks > 0 && engine == SimulationEngine::Queue && tick % compressionInterval == 0)
+    {
+        compressSleepingChunks();
+    }
+    if (engine == SimulationEngine::Margolus)
+    {
+        stepMargolus();
+        return;
+    }
+
+    for (GridDomain& domain : domains)
+    {
+        if (budget.isUnbounded() && domain.deferredUpdates.empty())
+        {
+            domain.localUpdates = std::move(domain.pendingUpdates);
+            domain.pendingUpdates.clear();
+        }
+        else
+        {
+            collectUpdates(domain, !budget.isUnbounded());
+        }
+    }
+
+    const int domainCount = static_cast<int>(domains.size());
+    const int maxUpdates = budget.maxUpdates > 0 ? std::max(1, (budget.maxUpdates + domainCount - 1) / domainCount) : 0;
+    std::chrono::steady_clock::time_point deadline;
+    if (budget.maxTime.count() > 0)
+    {
+        deadline = std::chrono::steady_clock::now() + budget.maxTime;
+    }
+
+    if (domains.size() == 1)
+    {
+        stepDomain(domains[0], maxUpdates, deadline);
+        levelLiquids();
+        return;
+    }
+
+    for (int phase = 0; phase < DomainPhases; ++phase)
+    {
+        runPhase(phase, [this, maxUpdates, deadline](GridDomain& domain)
+        {
+            stepDomain(domain, maxUpdates, deadline);
+        });
+
+        // handing over in a fixed order keeps the queues the same whatever thread finished first
+        for (int domainIndex : domainPhases[phase])
+        {
+            exchangeHalo(domains[domainIndex]);
+        }
+    }
+    levelLiquids();
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::collectUpdates(GridDomain& domain, bool prioritize)
+{
+    // priority and index, the queue order is kept between cells of the same priority
+    std::vector<std::pair<int, int>> updates;
+    while (!domain.pendingUpdates.empty())
+    {
+        const int index = domain.pendingUpdates.front();
+        updates.emplace_back(prioritize ? getUpdatePriority(index) : 0, index);
+        domain.pendingUpdates.pop();
+    }
+    if (prioritize)
+    {
+        std::stable_sort(updates.begin(), updates.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b)
+        {
+            return a.first < b.first;
+        });
+    }
+
+    // the deferred updates keep their order and are done before anything that became pending since
+    domain.localUpdates.clear();
+    for (int index : domain.deferredUpdates)
+    {
+        domain.localUpdates.push(index);
+    }
+    domain.deferredUpdates.clear();
+    for (const auto& [priority, index] : updates)
+    {
+        domain.localUpdates.push(index);
+    }
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getUpdatePriority(int index) const
+{
+    // lower goes first: a falling cell that moves first makes room for the ones above it
+    const int r = index / width;
+    const std::unique_ptr<Cell>& cell = getCell(r, index % width);
+    if (cell && cell->getTraits().type == CellType::Gas)
+    {
+        return r;
+    }
+    return heigth - 1 - r;
+}
+
+template <typename Layout>
+template <typename Task>
+void BasicCellGrid<Layout>::runPhase(int phase, const Task& task)
+{
+    // domains of one phase don't touch each other, the order they are stepped in doesn't change the result
+    const std::vector<std::vector<int>>& groups = phaseGroups[phase];
+    auto stepGroup = [this, &groups, &task](int i)
+    {
+        for (int domainIndex : groups[i])
+        {
+            task(domains[domainIndex]);
+        }
+    };
+    if (threadPool)
+    {
+        threadPool->parallelFor(static_cast<int>(groups.size()), stepGroup);
+    }
+    else
+    {
+        for (int i = 0; i < static_cast<int>(groups.size()); ++i)
+        {
+            stepGroup(i);
+        }
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::stepMargolus()
+{
+    // cells created by edits were queued, nothing reads the queue here
+    for (GridDomain& domain : domains)
+    {
+        domain.pendingUpdates.clear();
+        domain.deferredUpdates.clear();
+    }
+
+    // blocks start on even cells on even ticks and on odd cells on odd ones
+    const int offset = static_cast<int>(tick % 2);
+    if (domains.size() == 1)
+    {
+        sweepMargolusDomain(domains[0], offset);
+        return;
+    }
+
+    // a block belongs to the domain of its top left cell and reaches one cell into the next domain,
+    // the phases keep two domains from touching the same chunk at once
+    for (int phase = 0; phase < DomainPhases; ++phase)
+    {
+        runPhase(phase, [this, offset](GridDomain& domain)
+        {
+            sweepMargolusDomain(domain, offset);
+        });
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::sweepMargolusDomain(GridDomain& domain, int offset)
+{
+    const int firstRow = domain.top + (domain.top + offset) % 2;
+    const int firstColumn = domain.left + (domain.left + offset) % 2;
+    const int lastRow = std::min(domain.bottom, heigth - 1);
+    const int lastColumn = std::min(domain.right, width - 1);
+    activeDomain = &domain;
+    for (int r = firstRow; r < lastRow; r += 2)
+    {
+        for (int c = firstColumn; c < lastColumn; c += 2)
+        {
+            stepMargolusBlock(r, c);
+            domain.updatedCells += 4;
+        }
+    }
+    activeDomain = nullptr;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::stepMargolusBlock(int r, int c)
+{
+    const std::unique_ptr<Cell>* slots[4] = { &grid(r, c), &grid(r, c + 1), &grid(r + 1, c), &grid(r + 1, c + 1) };
+    BlockClass classes[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        classes[i] = MargolusRules::classify(*slots[i]);
+    }
+
+    bool movedColumn[2] = {};
+    const BlockMove& move = margolusRules.getMove(classes);
+    for (int i = 0; i < move.swapCount; ++i)
+    {
+        const int upper = move.swaps[i][0];
+        const int lower = move.swaps[i][1];
+        const std::unique_ptr<Cell>& upperCell = *slots[upper];
+        const std::unique_ptr<Cell>& lowerCell = *slots[lower];
+        // the table doesn't know densities: two cells only trade rows when the denser one goes down
+        if (upper / 2 != lower / 2 && upperCell && lowerCell && upperCell->getTraits().density <= lowerCell->getTraits().density)
+        {
+            continue;
+        }
+        moveBlockCells(r + upper / 2, c + upper % 2, r + lower / 2, c + lower % 2);
+        movedColumn[upper % 2] = true;
+        movedColumn[lower % 2] = true;
+    }
+
+    // layers of liquids and gases of one kind but different densities
+    for (int j = 0; j < 2; ++j)
+    {
+        const std::unique_ptr<Cell>& upperCell = *slots[j];
+        const std::unique_ptr<Cell>& lowerCell = *slots[j + 2];
+        if (movedColumn[j] || !upperCell || !lowerCell)
+        {
+            continue;
+        }
+        const CellTraits& upperTraits = upperCell->getTraits();
+        const CellTraits& lowerTraits = lowerCell->getTraits();
+        if (upperTraits.type == lowerTraits.type && (upperTraits.type == CellType::Liquid || upperTraits.type == CellType::Gas)
+            && upperTraits.density > lowerTraits.density)
+        {
+            moveBlockCells(r, c + j, r + 1, c + j);
+        }
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::moveBlockCells(int r1, int c1, int r2, int c2)
+{
+    countMove(r1, c1, r2);
+    trackCell(r1, c1, grid(r1, c1), -1);
+    trackCell(r2, c2, grid(r2, c2), -1);
+    std::swap(grid(r1, c1), grid(r2, c2));
+    trackCell(r1, c1, grid(r1, c1), 1);
+    trackCell(r2, c2, grid(r2, c2), 1);
+
+    if (grid(r1, c1))
+    {
+        grid(r1, c1)->updatePosition(r1, c1);
+    }
+    if (grid(r2, c2))
+    {
+        grid(r2, c2)->updatePosition(r2, c2);
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::levelLiquids()
+{
+    std::vector<int> seeds;
+    for (GridDomain& domain : domains)
+    {
+        seeds.insert(seeds.end(), domain.settledLiquids.begin(), domain.settledLiquids.end());
+        domain.settledLiquids.clear();
+    }
+
+    if (!seeds.empty())
+    {
+        liquidSolver.solve(*this, seeds);
+    }
+}
+
+template <typename Layout>
+uint64_t BasicCellGrid<Layout>::getTick() const
+{
+    return tick;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getPendingCount() const
+{
+    size_t count = 0;
+    for (const GridDomain& domain : domains)
+    {
+        count += domain.pendingUpdates.size() + domain.deferredUpdates.size();
+    }
+    return static_cast<int>(count);
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getDeferredCount() const
+{
+    size_t count = 0;
+    for (const GridDomain& domain : domains)
+    {
+        count += domain.deferredUpdates.size();
+    }
+    return static_cast<int>(count);
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getUpdatedCount() const
+{
+    int count = 0;
+    for (const GridDomain& domain : domains)
+    {
+        count += domain.updatedCells;
+    }
+    return count;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getVerticalMoveCount() const
+{
+    int count = 0;
+    for (const GridDomain& domain : domains)
+    {
+        count += domain.verticalMoves;
+    }
+    return count;
+}
+
+template <typename Layout>
+GridSnapshot BasicCellGrid<Layout>::snapshot() const
+{
+    GridSnapshot result;
+    result.pages.assign(pages.begin(), pages.end());
+    result.materials = materialTraits;
+    result.width = width;
+    result.height = heigth;
+    result.chunkColumns = chunkColumns;
+    result.tick = tick;
+    return result;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::compactCells()
+{
+    grid.compact();
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::stepDomain(GridDomain& domain, int maxUpdates, std::chrono::steady_clock::time_point deadline)
+{
+    // the clock is only read every few updates, a domain always gets at least that many
+    constexpr int clockInterval = 64;
+    const bool timed = deadline != std::chrono::steady_clock::time_point();
+
+    activeDomain = &domain;
+    int updates = 0;
+    while (!domain.localUpdates.empty())
+    {
+        if ((maxUpdates > 0 && updates >= maxUpdates)
+            || (timed && updates > 0 && updates % clockInterval == 0 && std::chrono::steady_clock::now() >= deadline))
+        {
+            break;
+        }
+
+        const int updateIndex = domain.localUpdates.front();
+        domain.localUpdates.pop();
+        if (performCellUpdate(updateIndex))
+        {
+            ++domain.updatedCells;
+        }
+        ++updates;
+    }
+
+    while (!domain.localUpdates.empty())
+    {
+        domain.deferredUpdates.push_back(domain.localUpdates.front());
+        domain.localUpdates.pop();
+    }
+    activeDomain = nullptr;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::exchangeHalo(GridDomain& domain)
+{
+    for (int index : domain.haloUpdates)
+    {
+        domains[getDomainIndex(index / width, index % width)].pendingUpdates.push(index);
+        storages[getChunkIndex(index / width, index % width)].lastActiveTick = tick;
+    }
+    domain.haloUpdates.clear();
+}
+
+template <typename Layout>
+const std::unique_ptr<Cell>& BasicCellGrid<Layout>::getCell(int r, int c) const
 {
     if (r < 0 || c < 0 || r >= heigth || c >= width)
     {
-        return nullptr;
+        return noCell;
+    }
+
+    const std::unique_ptr<Cell>* cell = grid.find(r, c);
+    if (cell)
+    {
+        return *cell;
+    }
+
+    // a compressed chunk has released its cells and keeps the matter and the inertia of every cell in its runs
+    const CellRun& run = storages[getChunkIndex(r, c)].getRun(r % ChunkSize, c % ChunkSize);
+    if (run.material == NoMaterial)
+    {
+        return noCell;
     }
-    return grid[r][c];
+    return run.inertia < 0 ? reversedDefaults[run.material] : cellDefaults[run.material];
 }
 
-const std::unique_ptr<Cell>& CellGrid::getCellDefault(const std::string& cellName) const
+template <typename Layout>
+const std::unique_ptr<Cell>& BasicCellGrid<Layout>::getCellDefault(const std::string& cellName) const
 {
-    if (cellDefaults.count(cellName) != 0)
+    return getCellDefault(getMaterialId(cellName));
+}
+
+template <typename Layout>
+const std::unique_ptr<Cell>& BasicCellGrid<Layout>::getCellDefault(MaterialId material) const
+{
+    if (material < cellDefaults.size())
     {
-        return cellDefaults.at(cellName);
+        return cellDefaults[material];
     }
 
-    return nullptr;
+    return noCell;
 }
 
-bool CellGrid::isValidCellIndex(int r, int c) const
+template <typename Layout>
+MaterialId BasicCellGrid<Layout>::getMaterialId(const std::string& cellName) const
+{
+    auto it = materialIds.find(cellName);
+    if (it != materialIds.end())
+    {
+        return it->second;
+    }
+
+    return NoMaterial;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getMaterialCount() const
+{
+    return static_cast<int>(cellDefaults.size());
+}
+
+template <typename Layout>
+bool BasicCellGrid<Layout>::isValidCellIndex(int r, int c) const
 {
     return r >= 0 && c >= 0 && r < heigth && c < width;
 }
 
-bool CellGrid::isValidCell(int r, int c) const
+template <typename Layout>
+bool BasicCellGrid<Layout>::isValidCell(int r, int c) const
 {
-    return isValidCellIndex(r, c) && grid[r][c] != nullptr;
+    return getCell(r, c) != nullptr;
 }
 
-void CellGrid::swapCells(int r1, int c1, int r2, int c2)
+template <typename Layout>
+void BasicCellGrid<Layout>::swapCells(int r1, int c1, int r2, int c2)
 {
     if (!isValidCellIndex(r1, c1) || !isValidCellIndex(r2, c2))
     {
         return;
     }
-    auto temp = std::move(grid[r1][c1]);
-    grid[r1][c1] = std::move(grid[r2][c2]);
-    grid[r2][c2] = std::move(temp);
+    wakeCell(r1, c1);
+    wakeCell(r2, c2);
+    countMove(r1, c1, r2);
+    trackCell(r1, c1, grid(r1, c1), -1);
+    trackCell(r2, c2, grid(r2, c2), -1);
+    auto temp = std::move(grid(r1, c1));
+    grid(r1, c1) = std::move(grid(r2, c2));
+    grid(r2, c2) = std::move(temp);
+    trackCell(r1, c1, grid(r1, c1), 1);
+    trackCell(r2, c2, grid(r2, c2), 1);
     
-    if (grid[r1][c1])
+    if (grid(r1, c1))
     {
-        grid[r1][c1]->updatePosition(r1, c1);
+        grid(r1, c1)->updatePosition(r1, c1);
         addPendingCell(r1, c1);
         propagateDormancy(r1, c1);
     }
-    if (grid[r2][c2])
+    if (grid(r2, c2))
     {
-        grid[r2][c2]->updatePosition(r2, c2);
+        grid(r2, c2)->updatePosition(r2, c2);
         addPendingCell(r2, c2);
         propagateDormancy(r2, c2);
     }
 }
 
-std::vector<std::string> CellGrid::getCellNames() const
+template <typename Layout>
+std::vector<std::string> BasicCellGrid<Layout>::getCellNames() const
 {
     std::vector<std::string> cellNames;
-    cellNames.reserve(cellDefaults.size());
-    for (auto& [k, v] : cellDefaults)
+    cellNames.reserve(materialIds.size());
+    for (auto& [k, v] : materialIds)
     {
         cellNames.push_back(k);
     }
     return cellNames;
 }
 
-void CellGrid::performCellUpdate(int index)
+template <typename Layout>
+int BasicCellGrid<Layout>::getWidth() const
+{
+    return width;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getHeight() const
+{
+    return heigth;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getChunkRows() const
+{
+    return chunkRows;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getChunkColumns() const
+{
+    return chunkColumns;
+}
+
+template <typename Layout>
+const ChunkSummary& BasicCellGrid<Layout>::getChunk(int chunkRow, int chunkColumn) const
+{
+    return chunks[chunkRow * chunkColumns + chunkColumn];
+}
+
+template <typename Layout>
+std::shared_ptr<const ChunkPage> BasicCellGrid<Layout>::getPage(int chunkRow, int chunkColumn) const
+{
+    return pages[chunkRow * chunkColumns + chunkColumn];
+}
+
+template <typename Layout>
+const std::vector<CellRun>* BasicCellGrid<Layout>::getChunkRuns(int chunkRow, int chunkColumn) const
 {
+    const ChunkStorage& storage = storages[chunkRow * chunkColumns + chunkColumn];
+    return storage.compressed ? &storage.runs : nullptr;
+}
+
+template <typename Layout>
+bool BasicCellGrid<Layout>::performCellUpdate(int index)
+{
+    const int r = index / width;
+    const int c = index % width;
     // we want to filter out the possibility of updating the same cell multiple times in one frame.
     // if we have a cell with the same index already in pending updates - we will update it next frame
-    if (pendingUpdates.contains(index))
+    if (domains[getDomainIndex(r, c)].pendingUpdates.contains(index))
     {
-        return;
+        return false;
     }
-    const int r = index / width;
-    const int c = index % width;
     if (!isValidCell(r, c))
     {
-        return;
+        return false;
+    }
+    // a solid never moves by itself, there is no need to wake its chunk for it
+    if (!grid.find(r, c))
+    {
+        if (getCell(r, c)->getTraits().type == CellType::Solid)
+        {
+            return false;
+        }
+        wakeCell(r, c);
     }
 
-    grid[r][c]->step(this);
+    grid(r, c)->step(this);
+    return true;
 }
 
-void CellGrid::propagateDormancy(int r, int c)
+template <typename Layout>
+void BasicCellGrid<Layout>::propagateDormancy(int r, int c)
 {
     for (int i = -2; i <= 2; ++i)
     {
@@ -157,7 +873,46 @@ void CellGrid::propagateDormancy(int r, int c)
     }
 }
 
-void CellGrid::addCellDefault(const CellTraits& trait)
+template <typename Layout>
+void BasicCellGrid<Layout>::addCellDefaults(const std::vector<CellTraits>& cellTraits)
+{
+    resetCellDefaults();
+    for (auto& cellTrait : cellTraits)
+    {
+        if (materialIds.find(cellTrait.name) == materialIds.end())
+        {
+            addCellDefault(cellTrait);
+        }
+    }
+
+    auto traits = std::make_shared<std::vector<CellTraits>>();
+    traits->reserve(cellDefaults.size());
+    for (const auto& cellDefault : cellDefaults)
+    {
+        traits->push_back(cellDefault->getTraits());
+    }
+    materialTraits = std::move(traits);
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::addCellDefault(const CellTraits& trait)
+{
+    std::unique_ptr<Cell> newCell = makeCellDefault(trait, static_cast<MaterialId>(cellDefaults.size()));
+    if (!newCell)
+    {
+        return;
+    }
+
+    materialIds[trait.name] = newCell->getTraits().material;
+    // inertia is only ever a direction
+    std::unique_ptr<Cell> reversedCell = newCell->clone();
+    reversedCell->setInertia(-newCell->getInertia());
+    reversedDefaults.push_back(std::move(reversedCell));
+    cellDefaults.push_back(std::move(newCell));
+}
+
+template <typename Layout>
+std::unique_ptr<Cell> BasicCellGrid<Layout>::makeCellDefault(const CellTraits& trait, MaterialId material)
 {
     std::unique_ptr<Cell> newCell = nullptr;
     switch (trait.type)
@@ -178,25 +933,377 @@ void CellGrid::addCellDefault(const CellTraits& trait)
     
     if (!newCell)
     {
-        return;
+        return nullptr;
     }
 
-    newCell->load(trait);
-    cellDefaults[trait.name] = std::move(newCell);
-
+    CellTraits materialTrait = trait;
+    materialTrait.material = material;
+    newCell->load(materialTrait);
+    return newCell;
 }
 
-void CellGrid::resetCellDefaults()
+template <typename Layout>
+void BasicCellGrid<Layout>::resetCellDefaults()
 {
     cellDefaults.clear();
+    reversedDefaults.clear();
+    materialIds.clear();
 }
 
-void CellGrid::addPendingCell(int r, int c)
+template <typename Layout>
+void BasicCellGrid<Layout>::addPendingCell(int r, int c)
 {
     if (!isValidCell(r, c))
     {
         return;
     }
     const int index = r * width + c;
-    pendingUpdates.push(index);
+    GridDomain& owner = domains[getDomainIndex(r, c)];
+    if (activeDomain == nullptr || activeDomain == &owner)
+    {
+        owner.pendingUpdates.push(index);
+        storages[getChunkIndex(r, c)].lastActiveTick = tick;
+    }
+    else
+    {
+        activeDomain->haloUpdates.push_back(index);
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::rebuildChunks()
+{
+    chunks = std::vector<ChunkSummary>(chunkRows * chunkColumns);
+    for (ChunkSummary& chunk : chunks)
+    {
+        chunk.histogram.resize(cellDefaults.size());
+    }
+
+    // all the chunks start with one shared empty page, it is copied on the first write
+    auto emptyPage = std::make_shared<ChunkPage>();
+    emptyPage->materials.fill(NoMaterial);
+    pages.assign(chunks.size(), emptyPage);
+
+    for (int r = 0; r < heigth; ++r)
+    {
+        for (int c = 0; c < width; ++c)
+        {
+            trackCell(r, c, grid(r, c), 1);
+        }
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::trackCell(int r, int c, const std::unique_ptr<Cell>& cell, int delta)
+{
+    if (!cell)
+    {
+        return;
+    }
+
+    const int chunkIndex = getChunkIndex(r, c);
+    ChunkSummary& chunk = chunks[chunkIndex];
+    storages[chunkIndex].lastActiveTick = tick;
+    changedChunks[chunkIndex] = 1;
+    const int localIndex = (r % ChunkSize) * ChunkSize + c % ChunkSize;
+    const uint64_t bit = uint64_t(1) << (localIndex % 64);
+    if (delta > 0)
+    {
+        chunk.occupancy[localIndex / 64] |= bit;
+    }
+    else
+    {
+        chunk.occupancy[localIndex / 64] &= ~bit;
+    }
+
+    const CellTraits& traits = cell->getTraits();
+    if (traits.material < chunk.histogram.size())
+    {
+        chunk.histogram[traits.material] += delta;
+    }
+    chunk.typeCounts[static_cast<int>(traits.type)] += delta;
+
+    getWritablePage(chunkIndex).materials[localIndex] = delta > 0 ? traits.material : NoMaterial;
+}
+
+template <typename Layout>
+ChunkPage& BasicCellGrid<Layout>::getWritablePage(int chunkIndex)
+{
+    std::shared_ptr<ChunkPage>& page = pages[chunkIndex];
+    if (page.use_count() > 1)
+    {
+        page = std::make_shared<ChunkPage>(*page);
+    }
+    else
+    {
+        // the last snapshot may have let go of the page on another thread, its reads must be done before we write
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *page;
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getChunkIndex(int r, int c) const
+{
+    return (r / ChunkSize) * chunkColumns + c / ChunkSize;
+}
+
+template <typename Layout>
+std::vector<int> BasicCellGrid<Layout>::takeChangedChunks()
+{
+    std::vector<int> changed;
+    for (int chunkIndex = 0; chunkIndex < static_cast<int>(changedChunks.size()); ++chunkIndex)
+    {
+        if (changedChunks[chunkIndex])
+        {
+            changed.push_back(chunkIndex);
+            changedChunks[chunkIndex] = 0;
+        }
+    }
+    return changed;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::restoreChunk(int chunkIndex, const std::shared_ptr<const ChunkPage>& page)
+{
+    const int top = chunkIndex / chunkColumns * ChunkSize;
+    const int left = chunkIndex % chunkColumns * ChunkSize;
+    const int bottom = std::min(top + ChunkSize, heigth);
+    const int right = std::min(left + ChunkSize, width);
+    for (int r = top; r < bottom; ++r)
+    {
+        for (int c = left; c < right; ++c)
+        {
+            const int localIndex = (r % ChunkSize) * ChunkSize + c % ChunkSize;
+            const MaterialId material = page->materials[localIndex];
+            if (material == pages[chunkIndex]->materials[localIndex])
+            {
+                continue;
+            }
+
+            if (material == NoMaterial)
+            {
+                clearCell(r, c);
+            }
+            else
+            {
+                createCell(r, c, material);
+            }
+        }
+    }
+
+    // the contents are the same now, sharing the page again keeps the history from holding a copy of it.
+    // The next write copies it like for any page a snapshot holds
+    pages[chunkIndex] = std::const_pointer_cast<ChunkPage>(page);
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::compressSleepingChunks()
+{
+    for (int chunkIndex = 0; chunkIndex < static_cast<int>(storages.size()); ++chunkIndex)
+    {
+        const ChunkStorage& storage = storages[chunkIndex];
+        if (!storage.compressed && tick - storage.lastActiveTick >= static_cast<uint64_t>(chunkSleepTicks)
+            && chunks[chunkIndex].getOccupiedCount() > 0)
+        {
+            compressChunk(chunkIndex);
+        }
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::compressChunk(int chunkIndex)
+{
+    ChunkStorage& storage = storages[chunkIndex];
+    const int top = chunkIndex / chunkColumns * ChunkSize;
+    const int left = chunkIndex % chunkColumns * ChunkSize;
+    const int bottom = std::min(top + ChunkSize, heigth);
+    const int right = std::min(left + ChunkSize, width);
+
+    storage.runs.clear();
+    for (int r = top; r < bottom; ++r)
+    {
+        // runs never go past the end of a row
+        storage.rowRuns[r - top] = static_cast<uint16_t>(storage.runs.size());
+        CellRun run;
+        for (int c = left; c < right; ++c)
+        {
+            const std::unique_ptr<Cell>& cell = grid(r, c);
+            const MaterialId material = cell ? cell->getTraits().material : NoMaterial;
+            const int8_t inertia = static_cast<int8_t>(cell ? cell->getInertia() : 1);
+            if (run.length > 0 && (run.material != material || run.inertia != inertia))
+            {
+                storage.runs.push_back(run);
+                run.length = 0;
+            }
+            run.material = material;
+            run.inertia = inertia;
+            ++run.length;
+        }
+        storage.runs.push_back(run);
+    }
+    storage.runs.shrink_to_fit();
+    storage.compressed = true;
+    grid.release(chunkIndex);
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::wakeChunk(int chunkIndex)
+{
+    ChunkStorage& storage = storages[chunkIndex];
+    if (!storage.compressed)
+    {
+        return;
+    }
+
+    grid.allocate(chunkIndex);
+    const int top = chunkIndex / chunkColumns * ChunkSize;
+    const int left = chunkIndex % chunkColumns * ChunkSize;
+    const int right = std::min(left + ChunkSize, width);
+    int r = top;
+    int c = left;
+    for (const CellRun& run : storage.runs)
+    {
+        for (int i = 0; i < run.length; ++i, ++c)
+        {
+            if (run.material != NoMaterial)
+            {
+                grid(r, c) = cellDefaults[run.material]->clone();
+                grid(r, c)->updatePosition(r, c);
+                grid(r, c)->setInertia(run.inertia);
+            }
+        }
+        if (c == right)
+        {
+            ++r;
+            c = left;
+        }
+    }
+
+    storage.runs = std::vector<CellRun>();
+    storage.compressed = false;
+    storage.lastActiveTick = tick;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::wakeCell(int r, int c)
+{
+    const int chunkIndex = getChunkIndex(r, c);
+    if (storages[chunkIndex].compressed)
+    {
+        wakeChunk(chunkIndex);
+    }
 }
+
+template <typename Layout>
+void BasicCellGrid<Layout>::wakeAllChunks()
+{
+    for (int chunkIndex = 0; chunkIndex < static_cast<int>(storages.size()); ++chunkIndex)
+    {
+        wakeChunk(chunkIndex);
+    }
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::addSettledLiquid(int r, int c)
+{
+    if (!isValidCell(r, c))
+    {
+        return;
+    }
+    // the cell belongs to the domain that is stepping it
+    GridDomain& domain = activeDomain ? *activeDomain : domains[getDomainIndex(r, c)];
+    domain.settledLiquids.push_back(r * width + c);
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::countMove(int r1, int c1, int r2)
+{
+    if (r1 == r2)
+    {
+        return;
+    }
+    // the liquid solver and edits move cells outside of any domain, nothing else runs then
+    GridDomain& domain = activeDomain ? *activeDomain : domains[getDomainIndex(r1, c1)];
+    ++domain.verticalMoves;
+}
+
+template <typename Layout>
+void BasicCellGrid<Layout>::buildDomains(int domainRows, int domainColumns)
+{
+    // domains are made of whole chunks and are at least two chunks wide: this way the halos of the neighbours
+    // don't meet inside of a domain and two domains of one phase never update the same chunk summary
+    static_assert(2 * ChunkSize >= 2 * DomainHalo, "a domain must be wider than the halos of its neighbours");
+    const int heightInChunks = (heigth + ChunkSize - 1) / ChunkSize;
+    const int widthInChunks = (width + ChunkSize - 1) / ChunkSize;
+    const int groupRows = std::max(1, std::min(domainRows, heightInChunks / 2));
+    const int groupColumns = std::max(1, std::min(domainColumns, widthInChunks / 2));
+    // the queues and the order of the updates follow the domains, in deterministic mode they only depend on the grid size
+    domainRows = deterministic ? std::max(1, heightInChunks / 2) : groupRows;
+    domainColumns = deterministic ? std::max(1, widthInChunks / 2) : groupColumns;
+
+    domains = std::vector<GridDomain>(domainRows * domainColumns);
+    domainColumnCount = domainColumns;
+    for (int phase = 0; phase < DomainPhases; ++phase)
+    {
+        domainPhases[phase].clear();
+        phaseGroups[phase].assign(groupRows * groupColumns, {});
+    }
+
+    // the group of the requested domain the top left chunk of a domain is in
+    auto getGroup = [](int chunk, int chunkCount, int groupCount)
+    {
+        int group = 0;
+        while (group + 1 < groupCount && (group + 1) * chunkCount / groupCount <= chunk)
+        {
+            ++group;
+        }
+        return group;
+    };
+
+    rowDomains.resize(heigth);
+    columnDomains.resize(width);
+    for (int dr = 0; dr < domainRows; ++dr)
+    {
+        for (int dc = 0; dc < domainColumns; ++dc)
+        {
+            const int domainIndex = dr * domainColumns + dc;
+            GridDomain& domain = domains[domainIndex];
+            domain.top = std::min(heigth, dr * heightInChunks / domainRows * ChunkSize);
+            domain.bottom = std::min(heigth, (dr + 1) * heightInChunks / domainRows * ChunkSize);
+            domain.left = std::min(width, dc * widthInChunks / domainColumns * ChunkSize);
+            domain.right = std::min(width, (dc + 1) * widthInChunks / domainColumns * ChunkSize);
+            domain.phase = (dr % 2) * 2 + dc % 2;
+            domainPhases[domain.phase].push_back(domainIndex);
+
+            const int group = getGroup(dr * heightInChunks / domainRows, heightInChunks, groupRows) * groupColumns
+                + getGroup(dc * widthInChunks / domainColumns, widthInChunks, groupColumns);
+            phaseGroups[domain.phase][group].push_back(domainIndex);
+
+            for (int r = domain.top; r < domain.bottom; ++r)
+            {
+                rowDomains[r] = dr;
+            }
+            for (int c = domain.left; c < domain.right; ++c)
+            {
+                columnDomains[c] = dc;
+            }
+        }
+    }
+
+    for (std::vector<std::vector<int>>& groups : phaseGroups)
+    {
+        groups.erase(std::remove_if(groups.begin(), groups.end(), [](const std::vector<int>& group) { return group.empty(); }), groups.end());
+    }
+}
+
+template <typename Layout>
+int BasicCellGrid<Layout>::getDomainIndex(int r, int c) const
+{
+    return rowDomains[r] * domainColumnCount + columnDomains[c];
+}
+
+// the layouts a grid can be built with, see GridLayout.h
+#define INSTANTIATE_GRID(Layout) template class BasicCellGrid<Layout>;
+GRID_LAYOUTS(INSTANTIATE_GRID)
+#undef INSTANTIATE_GRID
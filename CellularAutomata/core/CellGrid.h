@@ -1,45 +1,183 @@
 ﻿#pragma once
+#include <chrono>
 #include <memory>
 #include <map>
 #include <set>
 #include <vector>
 
 #include "Cell.h"
+#include "CellGridFwd.h"
+#include "GridAccess.h"
+#include "GridChunk.h"
+#include "GridDomain.h"
+#include "GridEdit.h"
+#include "GridLayout.h"
+#include "GridSnapshot.h"
+#include "LiquidSolver.h"
+#include "StepBudget.h"
 #include "../utils/UniqueQueue.h"
 
 class Cell;
+class ThreadPool;
 
-class CellGrid
+// Layout decides where a cell is kept in memory, see GridLayout.h. The grid is compiled for the layouts listed
+// in GRID_LAYOUTS, CellGrid is the row-major one that everything but the layout benchmark uses.
+// Cells step through GridAccess, the grid itself calls its own functions directly
+template <typename Layout>
+class BasicCellGrid final : public GridAccess
 {
-typedef std::vector<std::vector<std::unique_ptr<Cell>>> GridType;
+typedef CellStorage<Layout> GridType;
 
 public:
-    ~CellGrid();
+    BasicCellGrid();
+    ~BasicCellGrid();
+    BasicCellGrid(BasicCellGrid&& other);
+    BasicCellGrid& operator=(BasicCellGrid&& other);
     void initialize(int w, int h);
+    // splits the grid into domainRows x domainColumns rectangles that are stepped in parallel by the threads
+    // of this process, halos are handed over in memory. The result doesn't depend on the number of threads,
+    // 1x1 is the plain sequential step.
+    // In deterministic mode the grid is always cut into the smallest domains and the split only decides
+    // which of them a worker steps, so the result is the same for every split as for 1x1
+    void setDomains(int domainRows, int domainColumns, int threadCount, bool pinThreads = false, bool deterministic = false);
+    // with levelling on, liquid bodies are levelled as a whole after every step and rest once they are level
+    void setLiquidLevelling(bool enabled);
+    bool isLiquidLevelling() const override;
+    // switching back to the queue engine wakes every cell, the Margolus engine keeps no queue
+    void setEngine(SimulationEngine newEngine);
+    SimulationEngine getEngine() const;
+    // chunks in which nothing has happened for sleepTicks are compressed, 0 turns it off.
+    // getCell keeps working for compressed cells and returns a default cell of the matter with the cell's inertia
+    void setChunkCompression(int sleepTicks);
+    int getCompressedChunkCount() const;
     void loadCellTypes(const std::vector<CellTraits>& cellTraits);
+    // swaps in new matter traits while keeping the world: cells are remapped to the new ids by name,
+    // cells of removed matters are erased and cells whose matter changed its type are recreated
+    void reloadCellTypes(const std::vector<CellTraits>& cellTraits);
     void createCell(int r, int c, const std::string& cellName);
+    void createCell(int r, int c, MaterialId material);
+    void clearCell(int r, int c);
+    // spans are clipped to the grid, cells that already hold the matter are left as they are
+    void applyEdit(const GridEdit& edit);
 
     void step();
+    // with a budget pending cells are updated by priority: falling matter from the bottom and gases from the top.
+    // What is left once the budget runs out is deferred and goes first on the next step.
+    // The Margolus engine always does the whole sweep
+    void step(const StepBudget& budget);
+    uint64_t getTick() const;
+    // cells that will be updated on the next step including the deferred ones, always 0 for the Margolus engine
+    int getPendingCount() const;
+    // updates the last step had no budget for
+    int getDeferredCount() const;
+    // cells the last step updated: the cells the queue engine stepped or all the cells the Margolus blocks went over
+    int getUpdatedCount() const;
+    // swaps between two rows the last step made. Cells that only went sideways are not counted,
+    // the Margolus blocks keep spreading liquids and gases sideways for good
+    int getVerticalMoveCount() const;
+    // must be taken between steps, on the thread that steps the grid
+    GridSnapshot snapshot() const;
+    // allocates every cell again in the order of the layout, so cells close in the grid are close on the heap too
+    void compactCells();
 
-    const std::unique_ptr<Cell>& getCell(int r, int c) const;
+    const std::unique_ptr<Cell>& getCell(int r, int c) const override;
     const std::unique_ptr<Cell>& getCellDefault(const std::string& cellName) const;
-    bool isValidCellIndex(int r, int c) const;
+    const std::unique_ptr<Cell>& getCellDefault(MaterialId material) const;
+    MaterialId getMaterialId(const std::string& cellName) const;
+    int getMaterialCount() const;
+    bool isValidCellIndex(int r, int c) const override;
     bool isValidCell(int r, int c) const;
-    void swapCells(int r1, int c1, int r2, int c2);
-    void addPendingCell(int r, int c);
+    void swapCells(int r1, int c1, int r2, int c2) override;
+    void addPendingCell(int r, int c) override;
+    void addSettledLiquid(int r, int c) override;
     std::vector<std::string> getCellNames() const;
 
+    int getWidth() const;
+    int getHeight() const;
+    int getChunkRows() const;
+    int getChunkColumns() const;
+    const ChunkSummary& getChunk(int chunkRow, int chunkColumn) const;
+    // matters of the chunk as they are now. The grid copies a page that is held elsewhere before writing to it,
+    // so whoever keeps the page can tell that the chunk changed from a different page
+    std::shared_ptr<const ChunkPage> getPage(int chunkRow, int chunkColumn) const;
+    // the runs of a compressed chunk row by row, nullptr while the chunk keeps its cells
+    const std::vector<CellRun>* getChunkRuns(int chunkRow, int chunkColumn) const;
+
 private:
+    friend class GridHistory;
+
     GridType grid;
-    std::map<std::string, std::unique_ptr<Cell>> cellDefaults {};
+    // indexed by MaterialId
+    std::vector<std::unique_ptr<Cell>> cellDefaults {};
+    // the same cells walking the other way, what getCell returns for those cells of compressed chunks
+    std::vector<std::unique_ptr<Cell>> reversedDefaults {};
+    std::map<std::string, MaterialId> materialIds {};
+    // copy of the traits for snapshots, replaced as a whole when the matters are reloaded
+    std::shared_ptr<const std::vector<CellTraits>> materialTraits;
     int width = 0;
     int heigth = 0;
+    uint64_t tick = 0;
+
+    std::vector<GridDomain> domains;
+    // domains of every phase in index order and the same domains grouped by the worker that steps them
+    std::vector<int> domainPhases[DomainPhases];
+    std::vector<std::vector<int>> phaseGroups[DomainPhases];
+    std::vector<int> rowDomains;
+    std::vector<int> columnDomains;
+    int domainColumnCount = 1;
+    bool deterministic = false;
+    std::unique_ptr<ThreadPool> threadPool;
 
-    UniqueQueue<int> pendingUpdates;
+    SimulationEngine engine = SimulationEngine::Queue;
+    bool liquidLevelling = false;
+    LiquidSolver liquidSolver;
+
+    std::vector<ChunkSummary> chunks;
+    std::vector<std::shared_ptr<ChunkPage>> pages;
+    std::vector<ChunkStorage> storages;
+    // chunks written since the last call to takeChangedChunks, one byte each so domains can set them in parallel
+    std::vector<uint8_t> changedChunks;
+    int chunkSleepTicks = 0;
+    int chunkRows = 0;
+    int chunkColumns = 0;
 
     void propagateDormancy(int r, int c);
 
-    void performCellUpdate(int index);
+    void buildDomains(int domainRows, int domainColumns);
+    int getDomainIndex(int r, int c) const;
+    void collectUpdates(GridDomain& domain, bool prioritize);
+    int getUpdatePriority(int index) const;
+    void stepDomain(GridDomain& domain, int maxUpdates = 0, std::chrono::steady_clock::time_point deadline = {});
+    void exchangeHalo(GridDomain& domain);
+    void levelLiquids();
+    template <typename Task>
+    void runPhase(int phase, const Task& task);
+
+    void stepMargolus();
+    void sweepMargolusDomain(GridDomain& domain, int offset);
+    void stepMargolusBlock(int r, int c);
+    void moveBlockCells(int r1, int c1, int r2, int c2);
+    void countMove(int r1, int c1, int r2);
+
+    void rebuildChunks();
+    void trackCell(int r, int c, const std::unique_ptr<Cell>& cell, int delta);
+    ChunkPage& getWritablePage(int chunkIndex);
+    int getChunkIndex(int r, int c) const;
+
+    std::vector<int> takeChangedChunks();
+    // sets every cell of the chunk to the matter in the page and shares the page from then on
+    void restoreChunk(int chunkIndex, const std::shared_ptr<const ChunkPage>& page);
+
+    void compressSleepingChunks();
+    void compressChunk(int chunkIndex);
+    void wakeChunk(int chunkIndex);
+    void wakeCell(int r, int c);
+    void wakeAllChunks();
+
+    // false if there was nothing to step
+    bool performCellUpdate(int index);
+    void addCellDefaults(const std::vector<CellTraits>& cellTraits);
     void addCellDefault(const CellTraits& trait);
+    static std::unique_ptr<Cell> makeCellDefault(const CellTraits& trait, MaterialId material);
     void resetCellDefaults();
 };
@@ -0,0 +1,8 @@
+﻿#pragma once
+
+struct RowMajorLayout;
+
+template <typename Layout = RowMajorLayout>
+class BasicCellGrid;
+
+typedef BasicCellGrid<> CellGrid;
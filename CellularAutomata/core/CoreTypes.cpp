@@ -1,6 +1,6 @@
 ﻿#include "CoreTypes.h"
 
-CellType fromStr(std::string str)
+std::optional<CellType> fromStr(std::string_view str)
 {
 
     if (str == "gr")
@@ -21,5 +21,5 @@ CellType fromStr(std::string str)
     }
 
 
-    return CellType::Grain;
+    return std::nullopt;
 }
@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include <cstdint>
-#include <string>
+#include <limits>
+#include <optional>
+#include <string_view>
 
 enum class CellType : uint8_t
 {
@@ -10,4 +12,17 @@ enum class CellType : uint8_t
     Gas
 };
 
-CellType fromStr(std::string str);
\ No newline at end of file
+// how CellGrid::step moves the cells
+enum class SimulationEngine : uint8_t
+{
+    // cells step themselves from the queue of pending updates
+    Queue,
+    // every 2x2 block is rearranged at once by a transition table, the blocks shift by one cell every other tick
+    Margolus
+};
+
+// index of a matter in the order it was loaded from config
+typedef uint16_t MaterialId;
+constexpr MaterialId NoMaterial = std::numeric_limits<MaterialId>::max();
+
+std::optional<CellType> fromStr(std::string_view str);
@@ -0,0 +1,198 @@
+﻿#include "Ensemble.h"
+
+#include "../utils/ThreadPool.h"
+
+Ensemble::Ensemble(int worldWidth, int worldHeight, int threadCount, bool pinThreads)
+    : width(worldWidth), height(worldHeight)
+{
+    if (threadCount > 1)
+    {
+        threadPool = std::make_unique<ThreadPool>(threadCount - 1, pinThreads);
+    }
+}
+
+Ensemble::~Ensemble() = default;
+
+Ensemble::World::~World()
+{
+    CellArena::Scope scope(arena);
+    grid = CellGrid();
+}
+
+void Ensemble::reserve(int worldCount)
+{
+    worlds.reserve(worldCount);
+}
+
+int Ensemble::addWorld(const std::vector<CellTraits>& cellTraits, uint32_t seed)
+{
+    World& world = worlds.emplace_back();
+    world.grid.initialize(width, height);
+    world.grid.loadCellTypes(cellTraits);
+    world.seed = seed;
+    return static_cast<int>(worlds.size()) - 1;
+}
+
+void Ensemble::populate(const Populate& populate)
+{
+    auto populateWorld = [this, &populate](int i)
+    {
+        World& world = worlds[i];
+        populate(world.grid, world.seed);
+
+        // the cells are made again in storage order, the ones on the heap go back to it
+        int cellCount = 0;
+        for (int r = 0; r < height; ++r)
+        {
+            for (int c = 0; c < width; ++c)
+            {
+                cellCount += world.grid.getCell(r, c) ? 1 : 0;
+            }
+        }
+        world.arena = CellArena(cellCount);
+        CellArena::Scope scope(world.arena);
+        world.grid.compactCells();
+    };
+
+    if (threadPool)
+    {
+        threadPool->parallelFor(getWorldCount(), populateWorld);
+    }
+    else
+    {
+        for (int i = 0; i < getWorldCount(); ++i)
+        {
+            populateWorld(i);
+        }
+    }
+}
+
+int Ensemble::step()
+{
+    for (const World& world : worlds)
+    {
+        worldFrames += world.settled ? 0 : 1;
+    }
+
+    auto stepIndex = [this](int i)
+    {
+        stepWorld(worlds[i]);
+    };
+
+    if (threadPool)
+    {
+        threadPool->parallelFor(getWorldCount(), stepIndex);
+    }
+    else
+    {
+        for (int i = 0; i < getWorldCount(); ++i)
+        {
+            stepIndex(i);
+        }
+    }
+
+    int running = 0;
+    for (const World& world : worlds)
+    {
+        running += world.settled ? 0 : 1;
+    }
+    return running;
+}
+
+void Ensemble::run(uint64_t maxTicks)
+{
+    for (uint64_t i = 0; i < maxTicks; ++i)
+    {
+        if (step() == 0)
+        {
+            break;
+        }
+    }
+
+    for (World& world : worlds)
+    {
+        summarize(world);
+    }
+}
+
+int Ensemble::getWorldCount() const
+{
+    return static_cast<int>(worlds.size());
+}
+
+const CellGrid& Ensemble::getWorld(int index) const
+{
+    return worlds[index].grid;
+}
+
+const WorldSummary& Ensemble::getSummary(int index) const
+{
+    return worlds[index].summary;
+}
+
+uint64_t Ensemble::getWorldFrames() const
+{
+    return worldFrames;
+}
+
+void Ensemble::stepWorld(World& world)
+{
+    if (world.settled)
+    {
+        return;
+    }
+
+    CellArena::Scope scope(world.arena);
+    world.grid.step();
+    if (world.grid.getEngine() == SimulationEngine::Queue)
+    {
+        world.settled = world.grid.getPendingCount() == 0;
+        world.summary.settleTick = world.grid.getTick();
+    }
+    else
+    {
+        if (world.grid.getVerticalMoveCount() > 0)
+        {
+            world.stillTicks = 0;
+            world.lastMoveTick = world.grid.getTick();
+        }
+        else
+        {
+            ++world.stillTicks;
+        }
+        world.settled = world.stillTicks >= 2;
+        world.summary.settleTick = world.lastMoveTick;
+    }
+    world.summary.settled = world.settled;
+}
+
+void Ensemble::summarize(World& world)
+{
+    const CellGrid& grid = world.grid;
+    const int materialCount = grid.getMaterialCount();
+    std::vector<double> rowSums(materialCount, 0.0);
+    world.summary.cellCounts.assign(materialCount, 0);
+
+    for (int r = 0; r < grid.getHeight(); ++r)
+    {
+        for (int c = 0; c < grid.getWidth(); ++c)
+        {
+            const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+            if (cell)
+            {
+                const MaterialId material = cell->getTraits().material;
+                ++world.summary.cellCounts[material];
+                rowSums[material] += r;
+            }
+        }
+    }
+
+    world.summary.meanRows.assign(materialCount, -1.0f);
+    for (int i = 0; i < materialCount; ++i)
+    {
+        if (world.summary.cellCounts[i] > 0)
+        {
+            world.summary.meanRows[i] = static_cast<float>(rowSums[i] / world.summary.cellCounts[i]);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "CellArena.h"
+#include "CellGrid.h"
+
+class ThreadPool;
+
+// what is left of a world once it has been run
+struct WorldSummary
+{
+    bool settled = false;
+    // queue engine: the tick after which nothing was pending anymore,
+    // Margolus engine: the last tick on which a cell went up or down
+    uint64_t settleTick = 0;
+    // indexed by MaterialId of the world
+    std::vector<int> cellCounts;
+    // average row of the cells of each matter, -1 for a matter with no cells
+    std::vector<float> meanRows;
+};
+
+// Many small independent worlds stepped together on one thread pool, e.g. for sweeps over matter densities.
+// Every world has its own matters and seed and is always stepped whole by one thread,
+// a world that has settled is not stepped anymore. Under the queue engine a world has settled once nothing
+// is pending. The Margolus blocks have no queue and keep spreading liquids and gases sideways for good,
+// there a world has settled once no cell went up or down for two ticks, so both block offsets had their turn.
+// The cells of every world are in one CellArena of their own.
+class Ensemble
+{
+public:
+    typedef std::function<void(CellGrid& grid, uint32_t seed)> Populate;
+
+    Ensemble(int worldWidth, int worldHeight, int threadCount, bool pinThreads = false);
+    ~Ensemble();
+
+    void reserve(int worldCount);
+    // returns the index of the world
+    int addWorld(const std::vector<CellTraits>& cellTraits, uint32_t seed);
+    // calls populate for every world with its seed, in parallel, then moves the cells of every world
+    // into an arena just big enough for them
+    void populate(const Populate& populate);
+
+    // returns the number of worlds that still move
+    int step();
+    // steps until every world has settled or maxTicks have passed, then fills the summaries
+    void run(uint64_t maxTicks);
+
+    int getWorldCount() const;
+    const CellGrid& getWorld(int index) const;
+    const WorldSummary& getSummary(int index) const;
+    // one world stepped once is one frame
+    uint64_t getWorldFrames() const;
+
+private:
+    struct World
+    {
+        World() = default;
+        World(World&& other) = default;
+        World& operator=(World&& other) = default;
+        // lets go of the cells with the arena active
+        ~World();
+
+        // declared first, it outlives the grid
+        CellArena arena;
+        CellGrid grid;
+        uint32_t seed = 0;
+        bool settled = false;
+        int stillTicks = 0;
+        uint64_t lastMoveTick = 0;
+        WorldSummary summary;
+    };
+
+    int width = 0;
+    int height = 0;
+    // never reallocated while stepping
+    std::vector<World> worlds;
+    std::unique_ptr<ThreadPool> threadPool;
+    uint64_t worldFrames = 0;
+
+    void stepWorld(World& world);
+    static void summarize(World& world);
+};
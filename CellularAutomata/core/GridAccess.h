@@ -0,0 +1,21 @@
+﻿#pragma once
+#include <memory>
+
+class Cell;
+
+// What a cell sees of the grid while it steps. BasicCellGrid implements it for every layout,
+// so the cells step the same way whatever layout the grid keeps them in
+class GridAccess
+{
+public:
+    virtual const std::unique_ptr<Cell>& getCell(int r, int c) const = 0;
+    virtual bool isValidCellIndex(int r, int c) const = 0;
+    virtual bool isLiquidLevelling() const = 0;
+    virtual void swapCells(int r1, int c1, int r2, int c2) = 0;
+    virtual void addPendingCell(int r, int c) = 0;
+    // a liquid cell that would only walk over the same liquid, handed to the liquid solver instead of the queue
+    virtual void addSettledLiquid(int r, int c) = 0;
+
+protected:
+    ~GridAccess() = default;
+};
@@ -0,0 +1,69 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "CoreTypes.h"
+
+constexpr int ChunkSize = 16;
+constexpr int ChunkArea = ChunkSize * ChunkSize;
+
+// Summary of a ChunkSize x ChunkSize square of the grid, kept up to date by the grid on every change,
+// so region queries can skip whole chunks instead of visiting cells
+struct ChunkSummary
+{
+    // bit (r % ChunkSize) * ChunkSize + c % ChunkSize is set for every occupied cell
+    std::array<uint64_t, ChunkArea / 64> occupancy = {};
+    // number of cells of every matter, indexed by MaterialId
+    std::vector<uint16_t> histogram;
+    // number of cells of every CellType
+    std::array<uint16_t, 4> typeCounts = {};
+
+    int getOccupiedCount() const
+    {
+        int count = 0;
+        for (uint64_t bits : occupancy)
+        {
+            for (; bits != 0; bits &= bits - 1)
+            {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    bool isOccupied(int localIndex) const
+    {
+        return (occupancy[localIndex / 64] >> (localIndex % 64)) & 1;
+    }
+};
+
+
+// cells next to each other in a row of a compressed chunk that have the same matter and inertia
+struct CellRun
+{
+    MaterialId material = NoMaterial;
+    int8_t inertia = 1;
+    uint8_t length = 0;
+};
+
+// How a chunk keeps its cells. A chunk that has been asleep long enough frees its Cell objects
+// and keeps them as runs along its rows until something wakes it
+struct ChunkStorage
+{
+    uint64_t lastActiveTick = 0;
+    bool compressed = false;
+    std::vector<CellRun> runs;
+    // index of the first run of every row, so a cell is found without going through the rows above it
+    std::array<uint16_t, ChunkSize> rowRuns = {};
+
+    const CellRun& getRun(int localRow, int localColumn) const
+    {
+        const CellRun* run = &runs[rowRuns[localRow]];
+        for (int column = run->length; column <= localColumn; column += run->length)
+        {
+            ++run;
+        }
+        return *run;
+    }
+};
@@ -0,0 +1,35 @@
+﻿#pragma once
+#include <vector>
+
+#include "../utils/UniqueQueue.h"
+
+// how far a cell update may reach outside of the updated cell: one cell for swapCells
+// plus the radius of propagateDormancy around the cell's new position
+constexpr int DomainHalo = 3;
+// domains are colored like a 2x2 checkerboard and are at least two chunks wide,
+// so halos of the domains of one color never overlap
+constexpr int DomainPhases = 4;
+
+// A rectangle of the grid that is stepped by a single thread.
+// Updates for the cells in the halo around it belong to the neighbouring domains
+// and are handed over to them once the phase is done.
+struct GridDomain
+{
+    int top = 0;
+    int left = 0;
+    int bottom = 0;
+    int right = 0;
+    int phase = 0;
+
+    UniqueQueue<int> pendingUpdates;
+    UniqueQueue<int> localUpdates;
+    std::vector<int> haloUpdates;
+    // updates that didn't fit into the budget of the last step, in the order they were due
+    std::vector<int> deferredUpdates;
+    // liquid cells that came to rest next to the same liquid during the step
+    std::vector<int> settledLiquids;
+    // cells stepped by the last step
+    int updatedCells = 0;
+    // swaps between two rows the last step made
+    int verticalMoves = 0;
+};
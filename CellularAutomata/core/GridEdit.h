@@ -0,0 +1,19 @@
+﻿#pragma once
+#include <vector>
+
+#include "CoreTypes.h"
+
+// columns [begin, end) of one row
+struct CellSpan
+{
+    int row = 0;
+    int begin = 0;
+    int end = 0;
+};
+
+// A batch of cells that are set to one matter at once, NoMaterial clears them
+struct GridEdit
+{
+    MaterialId material = NoMaterial;
+    std::vector<CellSpan> spans;
+};
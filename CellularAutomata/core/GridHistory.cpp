@@ -0,0 +1,194 @@
+﻿#include "GridHistory.h"
+
+#include <algorithm>
+
+#include "CellGrid.h"
+
+GridHistory::GridHistory(size_t inMemoryBudget)
+    : memoryBudget(inMemoryBudget)
+{
+}
+
+void GridHistory::setMemoryBudget(size_t bytes)
+{
+    memoryBudget = bytes;
+    coalesce();
+}
+
+void GridHistory::checkpoint(CellGrid& grid)
+{
+    const int chunkCount = grid.getChunkRows() * grid.getChunkColumns();
+    if (static_cast<int>(chunkVersions.size()) != chunkCount)
+    {
+        clear();
+        chunkVersions.resize(chunkCount);
+    }
+
+    // a new checkpoint means the world went on from the current one, what could be redone is gone
+    dropAfter(position);
+    std::vector<int> changed = grid.takeChangedChunks();
+    if (checkpoints.empty())
+    {
+        changed.resize(chunkCount);
+        for (int i = 0; i < chunkCount; ++i)
+        {
+            changed[i] = i;
+        }
+    }
+    else if (changed.empty())
+    {
+        return;
+    }
+
+    const int index = static_cast<int>(checkpoints.size());
+    for (int chunkIndex : changed)
+    {
+        chunkVersions[chunkIndex].push_back({index, grid.pages[chunkIndex]});
+        memoryUse += sizeof(ChunkPage);
+    }
+    checkpoints.push_back({grid.getTick(), std::move(changed)});
+    position = index;
+    coalesce();
+}
+
+bool GridHistory::undo(CellGrid& grid)
+{
+    saveLatest(grid);
+    if (position <= 0)
+    {
+        return false;
+    }
+    restore(grid, position - 1);
+    return true;
+}
+
+bool GridHistory::redo(CellGrid& grid)
+{
+    if (position < 0 || position + 1 >= static_cast<int>(checkpoints.size()))
+    {
+        return false;
+    }
+    restore(grid, position + 1);
+    return true;
+}
+
+bool GridHistory::rewind(CellGrid& grid, uint64_t tick)
+{
+    saveLatest(grid);
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), tick, [](uint64_t value, const Checkpoint& checkpoint)
+    {
+        return value < checkpoint.tick;
+    });
+    if (it == checkpoints.begin())
+    {
+        return false;
+    }
+    restore(grid, static_cast<int>(it - checkpoints.begin()) - 1);
+    return true;
+}
+
+void GridHistory::clear()
+{
+    checkpoints.clear();
+    chunkVersions.clear();
+    position = -1;
+    memoryUse = 0;
+}
+
+int GridHistory::getCheckpointCount() const
+{
+    return static_cast<int>(checkpoints.size());
+}
+
+int GridHistory::getPosition() const
+{
+    return position;
+}
+
+uint64_t GridHistory::getCheckpointTick(int index) const
+{
+    return checkpoints[index].tick;
+}
+
+size_t GridHistory::getMemoryUse() const
+{
+    return memoryUse;
+}
+
+void GridHistory::saveLatest(CellGrid& grid)
+{
+    // only the newest state is worth keeping, after an undo the world goes back to the checkpoint it left
+    if (position >= 0 && position + 1 == static_cast<int>(checkpoints.size()))
+    {
+        checkpoint(grid);
+    }
+}
+
+void GridHistory::restore(CellGrid& grid, int target)
+{
+    // what changed since the current checkpoint plus every chunk that differs between the two checkpoints
+    std::vector<int> chunks = grid.takeChangedChunks();
+    const int from = std::min(position, target) + 1;
+    const int to = std::max(position, target);
+    for (int i = from; i <= to; ++i)
+    {
+        chunks.insert(chunks.end(), checkpoints[i].chunks.begin(), checkpoints[i].chunks.end());
+    }
+    std::sort(chunks.begin(), chunks.end());
+    chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+
+    for (int chunkIndex : chunks)
+    {
+        const std::vector<Version>& versions = chunkVersions[chunkIndex];
+        auto it = std::upper_bound(versions.begin(), versions.end(), target, [](int value, const Version& version)
+        {
+            return value < version.checkpoint;
+        });
+        // the first checkpoint has every chunk, so there is always a version at or before the target
+        grid.restoreChunk(chunkIndex, std::prev(it)->page);
+    }
+
+    // the grid is the checkpoint now, the restore itself is not a change
+    grid.takeChangedChunks();
+    grid.tick = checkpoints[target].tick;
+    position = target;
+}
+
+void GridHistory::dropAfter(int index)
+{
+    for (int i = static_cast<int>(checkpoints.size()) - 1; i > index; --i)
+    {
+        for (int chunkIndex : checkpoints[i].chunks)
+        {
+            chunkVersions[chunkIndex].pop_back();
+            memoryUse -= sizeof(ChunkPage);
+        }
+    }
+    checkpoints.resize(std::max(index + 1, 0));
+}
+
+void GridHistory::coalesce()
+{
+    // the first two checkpoints become one until the budget is met,
+    // the checkpoint the grid is at and the one before it are always kept
+    while (memoryUse > memoryBudget && position >= 2)
+    {
+        for (int chunkIndex : checkpoints[1].chunks)
+        {
+            std::vector<Version>& versions = chunkVersions[chunkIndex];
+            versions.erase(versions.begin());
+            memoryUse -= sizeof(ChunkPage);
+        }
+        for (std::vector<Version>& versions : chunkVersions)
+        {
+            for (Version& version : versions)
+            {
+                version.checkpoint = std::max(0, version.checkpoint - 1);
+            }
+        }
+
+        checkpoints.erase(checkpoints.begin());
+        checkpoints[0].chunks.clear();
+        --position;
+    }
+}
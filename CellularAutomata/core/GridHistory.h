@@ -0,0 +1,61 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "CellGridFwd.h"
+#include "GridSnapshot.h"
+
+// Checkpoints of the grid that only keep the chunks changed since the checkpoint before.
+// The pages are shared with the grid the same way snapshots share them, so a checkpoint of a chunk that hasn't
+// been written since costs nothing, and going to another checkpoint only touches the chunks that differ.
+// Cells come back with their matter, anything else about them starts anew.
+class GridHistory
+{
+public:
+    explicit GridHistory(size_t inMemoryBudget = 64 * 1024 * 1024);
+
+    // once the pages held go over the budget, the oldest checkpoints are merged into one
+    void setMemoryBudget(size_t bytes);
+    // checkpoints after the current one are dropped, nothing is recorded when nothing has changed
+    void checkpoint(CellGrid& grid);
+    // undo from the last checkpoint keeps what happened since, so that redo can come back to it
+    bool undo(CellGrid& grid);
+    bool redo(CellGrid& grid);
+    // goes to the last checkpoint at or before tick
+    bool rewind(CellGrid& grid, uint64_t tick);
+    // the matter ids of the pages have to match the grid, so a reload of the matters starts a new history
+    void clear();
+
+    int getCheckpointCount() const;
+    int getPosition() const;
+    uint64_t getCheckpointTick(int index) const;
+    size_t getMemoryUse() const;
+
+private:
+    struct Version
+    {
+        int checkpoint = 0;
+        std::shared_ptr<const ChunkPage> page;
+    };
+
+    struct Checkpoint
+    {
+        uint64_t tick = 0;
+        // chunks that changed since the checkpoint before, the first checkpoint has all of them
+        std::vector<int> chunks;
+    };
+
+    std::vector<Checkpoint> checkpoints;
+    // versions of every chunk in the order of the checkpoints
+    std::vector<std::vector<Version>> chunkVersions;
+    int position = -1;
+    size_t memoryBudget = 0;
+    size_t memoryUse = 0;
+
+    void saveLatest(CellGrid& grid);
+    void restore(CellGrid& grid, int target);
+    void dropAfter(int index);
+    void coalesce();
+};
@@ -0,0 +1,209 @@
+﻿#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Cell.h"
+#include "GridChunk.h"
+
+// Layouts map a cell to its place in the storage of its chunk. They are plain types picked at compile time,
+// so the index math is inlined into every access.
+
+// rows one after another
+struct RowMajorLayout
+{
+    static constexpr const char* name = "row-major";
+
+    RowMajorLayout() = default;
+    RowMajorLayout(int w, int h)
+        : width(w), height(h)
+    {
+    }
+
+    size_t getSize() const
+    {
+        return static_cast<size_t>(width) * height;
+    }
+
+    size_t getIndex(int r, int c) const
+    {
+        return static_cast<size_t>(r) * width + c;
+    }
+
+    int width = 0;
+    int height = 0;
+};
+
+// TileSize x TileSize squares one after another, rows inside of a tile.
+// The neighbours a cell looks at are mostly in its own tile instead of in rows further apart.
+// A tile as big as the chunk is the row-major layout again
+template <int TileSize>
+struct TiledLayout
+{
+    static_assert((TileSize & (TileSize - 1)) == 0, "the tile size must be a power of two");
+    static constexpr const char* name = TileSize == 4 ? "tiled 4x4" : TileSize == 8 ? "tiled 8x8" : "tiled";
+
+    TiledLayout() = default;
+    TiledLayout(int w, int h)
+        : tileColumns((w + TileSize - 1) / TileSize), tileRows((h + TileSize - 1) / TileSize)
+    {
+    }
+
+    size_t getSize() const
+    {
+        return static_cast<size_t>(tileColumns) * tileRows * TileSize * TileSize;
+    }
+
+    size_t getIndex(int r, int c) const
+    {
+        const size_t tile = static_cast<size_t>(r / TileSize) * tileColumns + c / TileSize;
+        return tile * (TileSize * TileSize) + (r % TileSize) * TileSize + c % TileSize;
+    }
+
+    int tileColumns = 0;
+    int tileRows = 0;
+};
+
+// Z-order: the bits of the row and the column interleaved, so cells close in both directions stay close in memory.
+// Both sides are padded to a power of two, the longer side keeps its upper bits above the interleaved ones
+struct MortonLayout
+{
+    static constexpr const char* name = "morton";
+
+    MortonLayout() = default;
+    MortonLayout(int w, int h)
+        : rowBits(getBits(h)), columnBits(getBits(w))
+    {
+        interleavedBits = rowBits < columnBits ? rowBits : columnBits;
+    }
+
+    size_t getSize() const
+    {
+        return size_t(1) << (rowBits + columnBits);
+    }
+
+    size_t getIndex(int r, int c) const
+    {
+        const uint32_t mask = (uint32_t(1) << interleavedBits) - 1;
+        const size_t low = spreadBits(static_cast<uint32_t>(c) & mask) | (spreadBits(static_cast<uint32_t>(r) & mask) << 1);
+        const size_t high = static_cast<size_t>(r >> interleavedBits) | static_cast<size_t>(c >> interleavedBits);
+        return (high << (2 * interleavedBits)) | low;
+    }
+
+    int rowBits = 0;
+    int columnBits = 0;
+    int interleavedBits = 0;
+
+private:
+    static int getBits(int size)
+    {
+        int bits = 0;
+        while ((1 << bits) < size)
+        {
+            ++bits;
+        }
+        return bits;
+    }
+
+    // the lower 16 bits go to the even bits of the result
+    static size_t spreadBits(uint32_t value)
+    {
+        value = (value | (value << 8)) & 0x00ff00ffu;
+        value = (value | (value << 4)) & 0x0f0f0f0fu;
+        value = (value | (value << 2)) & 0x33333333u;
+        value = (value | (value << 1)) & 0x55555555u;
+        return value;
+    }
+};
+
+// every layout the grid is compiled for, GRID_LAYOUTS(X) expands X(Layout) for each of them
+#define GRID_LAYOUTS(X) \
+    X(RowMajorLayout) \
+    X(TiledLayout<8>) \
+    X(TiledLayout<4>) \
+    X(MortonLayout)
+
+// Cells of a grid, one block of ChunkArea slots per chunk laid out by Layout. A chunk that has been compressed
+// releases its block, find returns nullptr for its cells until the block is allocated again
+template <typename Layout>
+class CellStorage
+{
+public:
+    typedef std::array<std::unique_ptr<Cell>, ChunkArea> ChunkCells;
+
+    void resize(int w, int h)
+    {
+        layout = Layout(ChunkSize, ChunkSize);
+        chunkColumns = (w + ChunkSize - 1) / ChunkSize;
+        chunks.clear();
+        chunks.resize(static_cast<size_t>(chunkColumns) * ((h + ChunkSize - 1) / ChunkSize));
+        for (std::unique_ptr<ChunkCells>& chunk : chunks)
+        {
+            chunk = std::make_unique<ChunkCells>();
+        }
+    }
+
+    std::unique_ptr<Cell>& operator()(int r, int c)
+    {
+        return (*chunks[getChunkIndex(r, c)])[layout.getIndex(r % ChunkSize, c % ChunkSize)];
+    }
+
+    const std::unique_ptr<Cell>& operator()(int r, int c) const
+    {
+        return (*chunks[getChunkIndex(r, c)])[layout.getIndex(r % ChunkSize, c % ChunkSize)];
+    }
+
+    const std::unique_ptr<Cell>* find(int r, int c) const
+    {
+        const std::unique_ptr<ChunkCells>& chunk = chunks[getChunkIndex(r, c)];
+        return chunk ? &(*chunk)[layout.getIndex(r % ChunkSize, c % ChunkSize)] : nullptr;
+    }
+
+    // frees the block together with the cells still in it
+    void release(int chunkIndex)
+    {
+        chunks[chunkIndex].reset();
+    }
+
+    // a new empty block for a released chunk
+    void allocate(int chunkIndex)
+    {
+        if (!chunks[chunkIndex])
+        {
+            chunks[chunkIndex] = std::make_unique<ChunkCells>();
+        }
+    }
+
+    // clones every cell in storage order before the old ones are freed
+    void compact()
+    {
+        for (std::unique_ptr<ChunkCells>& chunk : chunks)
+        {
+            if (!chunk)
+            {
+                continue;
+            }
+            auto compacted = std::make_unique<ChunkCells>();
+            for (size_t i = 0; i < chunk->size(); ++i)
+            {
+                if ((*chunk)[i])
+                {
+                    (*compacted)[i] = (*chunk)[i]->clone();
+                }
+            }
+            chunk = std::move(compacted);
+        }
+    }
+
+private:
+    Layout layout;
+    int chunkColumns = 0;
+    std::vector<std::unique_ptr<ChunkCells>> chunks;
+
+    int getChunkIndex(int r, int c) const
+    {
+        return (r / ChunkSize) * chunkColumns + c / ChunkSize;
+    }
+};
@@ -0,0 +1,298 @@
+﻿#include "GridQuery.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_set>
+#include <vector>
+
+#include "CellGrid.h"
+
+namespace
+{
+    int getArea(const GridRect& rect)
+    {
+        return (rect.bottom - rect.top) * (rect.right - rect.left);
+    }
+
+    bool isSameRect(const GridRect& a, const GridRect& b)
+    {
+        return a.top == b.top && a.left == b.left && a.bottom == b.bottom && a.right == b.right;
+    }
+
+    bool isInside(const GridRect& inner, const GridRect& outer)
+    {
+        return inner.top >= outer.top && inner.left >= outer.left && inner.bottom <= outer.bottom && inner.right <= outer.right;
+    }
+
+    // offset of the i-th of steps points on a line that moves by delta, rounded to the nearest cell
+    int getLineOffset(int i, int delta, int steps)
+    {
+        const long long doubled = 2LL * i * delta + (delta >= 0 ? steps : -steps);
+        return static_cast<int>(doubled / (2LL * steps));
+    }
+}
+
+GridQuery::GridQuery(const CellGrid& inGrid) : grid(inGrid)
+{
+}
+
+int GridQuery::countCells(const GridRect& rect, MaterialId material) const
+{
+    int count = 0;
+    forEachChunk(clip(rect), [this, material, &count](const ChunkSummary& chunk, const GridRect& chunkRect, const GridRect& part)
+    {
+        const int chunkCount = getChunkCount(chunk, chunkRect, material);
+        if (chunkCount == 0 || isSameRect(part, chunkRect))
+        {
+            count += chunkCount;
+            return;
+        }
+
+        for (int r = part.top; r < part.bottom; ++r)
+        {
+            for (int c = part.left; c < part.right; ++c)
+            {
+                count += getMaterial(r, c) == material;
+            }
+        }
+    });
+    return count;
+}
+
+int GridQuery::countCells(const GridRect& rect, CellType type) const
+{
+    int count = 0;
+    forEachChunk(clip(rect), [this, type, &count](const ChunkSummary& chunk, const GridRect& chunkRect, const GridRect& part)
+    {
+        const int chunkCount = chunk.typeCounts[static_cast<int>(type)];
+        if (chunkCount == 0 || isSameRect(part, chunkRect))
+        {
+            count += chunkCount;
+            return;
+        }
+
+        for (int r = part.top; r < part.bottom; ++r)
+        {
+            for (int c = part.left; c < part.right; ++c)
+            {
+                const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+                count += cell && cell->getTraits().type == type;
+            }
+        }
+    });
+    return count;
+}
+
+std::optional<GridRect> GridQuery::getBounds(const GridRect& rect, MaterialId material) const
+{
+    std::optional<GridRect> bounds;
+    forEachChunk(clip(rect), [this, material, &bounds](const ChunkSummary& chunk, const GridRect& chunkRect, const GridRect& part)
+    {
+        // chunks that can't grow the bounds are skipped without looking at their cells
+        if (getChunkCount(chunk, chunkRect, material) == 0 || (bounds && isInside(part, *bounds)))
+        {
+            return;
+        }
+
+        for (int r = part.top; r < part.bottom; ++r)
+        {
+            for (int c = part.left; c < part.right; ++c)
+            {
+                if (getMaterial(r, c) != material)
+                {
+                    continue;
+                }
+                if (!bounds)
+                {
+                    bounds = GridRect{r, c, r + 1, c + 1};
+                    continue;
+                }
+                bounds->top = std::min(bounds->top, r);
+                bounds->left = std::min(bounds->left, c);
+                bounds->bottom = std::max(bounds->bottom, r + 1);
+                bounds->right = std::max(bounds->right, c + 1);
+            }
+        }
+    });
+    return bounds;
+}
+
+bool GridQuery::hasLineOfSight(int r1, int c1, int r2, int c2) const
+{
+    const int dr = r2 - r1;
+    const int dc = c2 - c1;
+    const int steps = std::max(std::abs(dr), std::abs(dc));
+
+    int i = 1;
+    while (i < steps)
+    {
+        const int r = r1 + getLineOffset(i, dr, steps);
+        const int c = c1 + getLineOffset(i, dc, steps);
+        if (!grid.isValidCellIndex(r, c))
+        {
+            ++i;
+            continue;
+        }
+
+        const int chunkRow = r / ChunkSize;
+        const int chunkColumn = c / ChunkSize;
+        if (grid.getChunk(chunkRow, chunkColumn).typeCounts[static_cast<int>(CellType::Solid)] == 0)
+        {
+            // the line only moves in one direction along every axis, once it leaves a chunk it never comes back,
+            // so the last point inside of the chunk can be found with a binary search
+            int low = i;
+            int high = steps - 1;
+            while (low < high)
+            {
+                const int mid = (low + high + 1) / 2;
+                const int midRow = r1 + getLineOffset(mid, dr, steps);
+                const int midColumn = c1 + getLineOffset(mid, dc, steps);
+                if (grid.isValidCellIndex(midRow, midColumn) && midRow / ChunkSize == chunkRow && midColumn / ChunkSize == chunkColumn)
+                {
+                    low = mid;
+                }
+                else
+                {
+                    high = mid - 1;
+                }
+            }
+            i = low + 1;
+            continue;
+        }
+
+        const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+        if (cell && cell->getTraits().type == CellType::Solid)
+        {
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+int GridQuery::getRegionSize(int r, int c, int limit) const
+{
+    if (!grid.isValidCellIndex(r, c))
+    {
+        return 0;
+    }
+
+    const int width = grid.getWidth();
+    const MaterialId material = getMaterial(r, c);
+    std::vector<uint8_t> visitedChunks(grid.getChunkRows() * grid.getChunkColumns());
+    std::unordered_set<int> visitedCells;
+    std::vector<int> frontier = {r * width + c};
+    int size = 0;
+
+    auto push = [this, width, &frontier](int row, int column)
+    {
+        if (grid.isValidCellIndex(row, column))
+        {
+            frontier.push_back(row * width + column);
+        }
+    };
+
+    while (!frontier.empty() && size < limit)
+    {
+        const int index = frontier.back();
+        frontier.pop_back();
+        const int row = index / width;
+        const int column = index % width;
+        const int chunkRow = row / ChunkSize;
+        const int chunkColumn = column / ChunkSize;
+        uint8_t& chunkVisited = visitedChunks[chunkRow * grid.getChunkColumns() + chunkColumn];
+        if (chunkVisited || getMaterial(row, column) != material)
+        {
+            continue;
+        }
+
+        // a chunk that is filled with the matter is connected as a whole: it is counted at once
+        // and the search goes on from the cells around it
+        const GridRect chunkRect = getChunkRect(chunkRow, chunkColumn);
+        if (getChunkCount(grid.getChunk(chunkRow, chunkColumn), chunkRect, material) == getArea(chunkRect))
+        {
+            chunkVisited = 1;
+            size += getArea(chunkRect);
+            for (int i = chunkRect.left; i < chunkRect.right; ++i)
+            {
+                push(chunkRect.top - 1, i);
+                push(chunkRect.bottom, i);
+            }
+            for (int i = chunkRect.top; i < chunkRect.bottom; ++i)
+            {
+                push(i, chunkRect.left - 1);
+                push(i, chunkRect.right);
+            }
+            continue;
+        }
+
+        if (!visitedCells.insert(index).second)
+        {
+            continue;
+        }
+        ++size;
+        push(row + 1, column);
+        push(row - 1, column);
+        push(row, column + 1);
+        push(row, column - 1);
+    }
+    return std::min(size, limit);
+}
+
+MaterialId GridQuery::getMaterial(int r, int c) const
+{
+    const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+    return cell ? cell->getTraits().material : NoMaterial;
+}
+
+GridRect GridQuery::clip(const GridRect& rect) const
+{
+    GridRect clipped;
+    clipped.top = std::max(rect.top, 0);
+    clipped.left = std::max(rect.left, 0);
+    clipped.bottom = std::max(clipped.top, std::min(rect.bottom, grid.getHeight()));
+    clipped.right = std::max(clipped.left, std::min(rect.right, grid.getWidth()));
+    return clipped;
+}
+
+GridRect GridQuery::getChunkRect(int chunkRow, int chunkColumn) const
+{
+    GridRect chunkRect;
+    chunkRect.top = chunkRow * ChunkSize;
+    chunkRect.left = chunkColumn * ChunkSize;
+    chunkRect.bottom = std::min(chunkRect.top + ChunkSize, grid.getHeight());
+    chunkRect.right = std::min(chunkRect.left + ChunkSize, grid.getWidth());
+    return chunkRect;
+}
+
+int GridQuery::getChunkCount(const ChunkSummary& chunk, const GridRect& chunkRect, MaterialId material) const
+{
+    if (material == NoMaterial)
+    {
+        return getArea(chunkRect) - chunk.getOccupiedCount();
+    }
+    return material < chunk.histogram.size() ? chunk.histogram[material] : 0;
+}
+
+template <typename F>
+void GridQuery::forEachChunk(const GridRect& rect, const F& visit) const
+{
+    if (getArea(rect) == 0)
+    {
+        return;
+    }
+
+    for (int chunkRow = rect.top / ChunkSize; chunkRow <= (rect.bottom - 1) / ChunkSize; ++chunkRow)
+    {
+        for (int chunkColumn = rect.left / ChunkSize; chunkColumn <= (rect.right - 1) / ChunkSize; ++chunkColumn)
+        {
+            const GridRect chunkRect = getChunkRect(chunkRow, chunkColumn);
+            GridRect part;
+            part.top = std::max(rect.top, chunkRect.top);
+            part.left = std::max(rect.left, chunkRect.left);
+            part.bottom = std::min(rect.bottom, chunkRect.bottom);
+            part.right = std::min(rect.right, chunkRect.right);
+            visit(grid.getChunk(chunkRow, chunkColumn), chunkRect, part);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <limits>
+#include <optional>
+
+#include "CellGridFwd.h"
+#include "CoreTypes.h"
+
+struct ChunkSummary;
+
+// half-open rectangle of cells: [top, bottom) x [left, right)
+struct GridRect
+{
+    int top = 0;
+    int left = 0;
+    int bottom = 0;
+    int right = 0;
+};
+
+// Questions about regions of the grid for tools and game logic. Answers come from the chunk summaries,
+// cells are only visited in chunks that are cut by the region and actually hold what is asked for.
+// Must be used from the thread that steps the grid.
+class GridQuery
+{
+public:
+    explicit GridQuery(const CellGrid& inGrid);
+
+    // NoMaterial counts empty cells
+    int countCells(const GridRect& rect, MaterialId material) const;
+    int countCells(const GridRect& rect, CellType type) const;
+    // the smallest rectangle inside of rect that holds every cell of the matter
+    std::optional<GridRect> getBounds(const GridRect& rect, MaterialId material) const;
+    // true if no solid cell lies on the line between the two cells, the end cells themselves are not checked
+    bool hasLineOfSight(int r1, int c1, int r2, int c2) const;
+    // size of the 4-connected region of cells with the same matter as the given one (empty cells for an empty one),
+    // stops counting at limit
+    int getRegionSize(int r, int c, int limit = std::numeric_limits<int>::max()) const;
+
+private:
+    const CellGrid& grid;
+
+    MaterialId getMaterial(int r, int c) const;
+    GridRect clip(const GridRect& rect) const;
+    GridRect getChunkRect(int chunkRow, int chunkColumn) const;
+    int getChunkCount(const ChunkSummary& chunk, const GridRect& chunkRect, MaterialId material) const;
+
+    template <typename F>
+    void forEachChunk(const GridRect& rect, const F& visit) const;
+};
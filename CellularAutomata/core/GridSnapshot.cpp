@@ -0,0 +1,93 @@
+﻿#include "GridSnapshot.h"
+
+bool GridSnapshot::isValid() const
+{
+    return materials != nullptr;
+}
+
+uint64_t GridSnapshot::getTick() const
+{
+    return tick;
+}
+
+int GridSnapshot::getWidth() const
+{
+    return width;
+}
+
+int GridSnapshot::getHeight() const
+{
+    return height;
+}
+
+MaterialId GridSnapshot::getMaterial(int r, int c) const
+{
+    if (r < 0 || c < 0 || r >= height || c >= width)
+    {
+        return NoMaterial;
+    }
+    return pages[(r / ChunkSize) * chunkColumns + c / ChunkSize]->materials[(r % ChunkSize) * ChunkSize + c % ChunkSize];
+}
+
+const CellTraits* GridSnapshot::getTraits(MaterialId material) const
+{
+    if (!materials || material >= materials->size())
+    {
+        return nullptr;
+    }
+    return &(*materials)[material];
+}
+
+int GridSnapshot::getMaterialCount() const
+{
+    return materials ? static_cast<int>(materials->size()) : 0;
+}
+
+int GridSnapshot::getChunkRows() const
+{
+    return chunkColumns > 0 ? static_cast<int>(pages.size()) / chunkColumns : 0;
+}
+
+int GridSnapshot::getChunkColumns() const
+{
+    return chunkColumns;
+}
+
+const ChunkPage* GridSnapshot::getPage(int chunkRow, int chunkColumn) const
+{
+    return pages[chunkRow * chunkColumns + chunkColumn].get();
+}
+
+void SnapshotExchange::publish(GridSnapshot snapshot)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // the old one is released outside of the lock below
+        std::swap(latest, snapshot);
+        ++version;
+    }
+    publishedCondition.notify_all();
+}
+
+GridSnapshot SnapshotExchange::acquire() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return latest;
+}
+
+bool SnapshotExchange::waitNewer(uint64_t& seenVersion) const
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    publishedCondition.wait(lock, [this, seenVersion]() { return closed || version != seenVersion; });
+    seenVersion = version;
+    return !closed;
+}
+
+void SnapshotExchange::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    publishedCondition.notify_all();
+}
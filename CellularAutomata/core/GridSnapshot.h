@@ -0,0 +1,69 @@
+﻿#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Cell.h"
+#include "GridChunk.h"
+
+// Matter of every cell of a chunk. The grid shares a page with every snapshot taken since the chunk last changed
+// and copies it on the next write, so a page never changes once a snapshot holds it.
+struct ChunkPage
+{
+    std::array<MaterialId, ChunkArea> materials;
+};
+
+// Immutable view of the grid at one tick. Taking one costs a pointer per chunk,
+// after that it can be read from any thread while the grid keeps stepping.
+class GridSnapshot
+{
+public:
+    bool isValid() const;
+    uint64_t getTick() const;
+    int getWidth() const;
+    int getHeight() const;
+
+    // NoMaterial for empty cells and cells outside of the grid
+    MaterialId getMaterial(int r, int c) const;
+    // traits as they were loaded when the snapshot was taken, nullptr for NoMaterial
+    const CellTraits* getTraits(MaterialId material) const;
+    int getMaterialCount() const;
+    int getChunkRows() const;
+    int getChunkColumns() const;
+    // two snapshots hold the same page for a chunk that didn't change between them
+    const ChunkPage* getPage(int chunkRow, int chunkColumn) const;
+
+private:
+    template <typename Layout>
+    friend class BasicCellGrid;
+
+    std::vector<std::shared_ptr<const ChunkPage>> pages;
+    std::shared_ptr<const std::vector<CellTraits>> materials;
+    int width = 0;
+    int height = 0;
+    int chunkColumns = 0;
+    uint64_t tick = 0;
+};
+
+// Hands the latest snapshot from the simulation thread over to observers on other threads.
+// An observer that is slower than the simulation skips the snapshots published in between
+class SnapshotExchange
+{
+public:
+    void publish(GridSnapshot snapshot);
+    GridSnapshot acquire() const;
+    // blocks until something newer than seenVersion is published, false once the exchange is closed
+    bool waitNewer(uint64_t& seenVersion) const;
+    // wakes every waiting observer for good
+    void close();
+
+private:
+    mutable std::mutex mutex;
+    mutable std::condition_variable publishedCondition;
+    GridSnapshot latest;
+    uint64_t version = 0;
+    bool closed = false;
+};
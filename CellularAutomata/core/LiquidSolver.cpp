@@ -0,0 +1,311 @@
+﻿#include "LiquidSolver.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "CellGrid.h"
+
+namespace
+{
+    template <typename Layout>
+    MaterialId getMaterial(const BasicCellGrid<Layout>& grid, int r, int c)
+    {
+        const std::unique_ptr<Cell>& cell = grid.getCell(r, c);
+        return cell ? cell->getTraits().material : NoMaterial;
+    }
+
+    template <typename Layout>
+    bool isEmpty(const BasicCellGrid<Layout>& grid, int r, int c)
+    {
+        return grid.isValidCellIndex(r, c) && !grid.getCell(r, c);
+    }
+
+    int getLocalIndex(int r, int c)
+    {
+        return (r % ChunkSize) * ChunkSize + c % ChunkSize;
+    }
+}
+
+template <typename Layout>
+void LiquidSolver::solve(BasicCellGrid<Layout>& grid, const std::vector<int>& seeds)
+{
+    const size_t chunkCount = static_cast<size_t>(grid.getChunkRows()) * grid.getChunkColumns();
+    if (chunks.size() != chunkCount)
+    {
+        chunks = std::vector<LiquidChunk>(chunkCount);
+    }
+
+    // every body gets its own stamp, a seed in a piece stamped by this solve has been levelled already
+    if (stamp > UINT32_MAX - seeds.size() - 1)
+    {
+        for (LiquidChunk& chunk : chunks)
+        {
+            for (BodyPiece& piece : chunk.pieces)
+            {
+                piece.visitStamp = 0;
+            }
+        }
+        stamp = 0;
+    }
+    solveStamp = stamp + 1;
+    for (int seed : seeds)
+    {
+        if (collectBody(grid, seed))
+        {
+            levelBody(grid, getMaterial(grid, seed / grid.getWidth(), seed % grid.getWidth()));
+        }
+    }
+}
+
+template <typename Layout>
+LiquidSolver::LiquidChunk& LiquidSolver::refreshChunk(const BasicCellGrid<Layout>& grid, int chunkIndex)
+{
+    // nothing moves while a body is collected, so the pieces of a chunk in the frontier stay as they are
+    LiquidChunk& chunk = chunks[chunkIndex];
+    const int chunkRow = chunkIndex / grid.getChunkColumns();
+    const int chunkColumn = chunkIndex % grid.getChunkColumns();
+    std::shared_ptr<const ChunkPage> page = grid.getPage(chunkRow, chunkColumn);
+    if (page == chunk.page)
+    {
+        return chunk;
+    }
+    chunk.page = std::move(page);
+    chunk.pieceOf.fill(NoPiece);
+    chunk.pieceCount = 0;
+
+    const std::array<MaterialId, ChunkArea>& materials = chunk.page->materials;
+    const int width = grid.getWidth();
+    const int top = chunkRow * ChunkSize;
+    const int left = chunkColumn * ChunkSize;
+    const int rows = std::min(ChunkSize, grid.getHeight() - top);
+    const int columns = std::min(ChunkSize, width - left);
+    for (int start = 0; start < ChunkArea; ++start)
+    {
+        const MaterialId material = materials[start];
+        if (material == NoMaterial || chunk.pieceOf[start] != NoPiece || material >= grid.getMaterialCount()
+            || grid.getCellDefault(material)->getTraits().type != CellType::Liquid)
+        {
+            continue;
+        }
+
+        // the vectors of the pieces are reused, so a chunk that changes every step doesn't allocate
+        if (chunk.pieceCount == static_cast<int>(chunk.pieces.size()))
+        {
+            chunk.pieces.emplace_back();
+        }
+        BodyPiece& piece = chunk.pieces[chunk.pieceCount];
+        piece.material = material;
+        piece.visitStamp = 0;
+        piece.surface.clear();
+        piece.freeCells.clear();
+        piece.borders.clear();
+
+        chunk.pieceOf[start] = static_cast<uint8_t>(chunk.pieceCount);
+        localFrontier.assign(1, start);
+        while (!localFrontier.empty())
+        {
+            const int local = localFrontier.back();
+            localFrontier.pop_back();
+            const int index = (top + local / ChunkSize) * width + left + local % ChunkSize;
+
+            constexpr int dirs[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+            for (const auto dir : dirs)
+            {
+                const int r = local / ChunkSize + dir[0];
+                const int c = local % ChunkSize + dir[1];
+                if (r < 0 || c < 0 || r >= rows || c >= columns)
+                {
+                    // the next chunk may change without this one, so its cells are only looked at when the body is levelled
+                    if (grid.isValidCellIndex(top + r, left + c))
+                    {
+                        piece.borders.push_back({index, index + dir[0] * width + dir[1]});
+                    }
+                    continue;
+                }
+
+                const int neighbour = r * ChunkSize + c;
+                if (materials[neighbour] == NoMaterial)
+                {
+                    piece.freeCells.push_back(index + dir[0] * width + dir[1]);
+                    if (dir[0] < 0)
+                    {
+                        piece.surface.push_back(index);
+                    }
+                }
+                else if (materials[neighbour] == material && chunk.pieceOf[neighbour] == NoPiece)
+                {
+                    chunk.pieceOf[neighbour] = static_cast<uint8_t>(chunk.pieceCount);
+                    localFrontier.push_back(neighbour);
+                }
+            }
+        }
+        ++chunk.pieceCount;
+    }
+    return chunk;
+}
+
+template <typename Layout>
+bool LiquidSolver::collectBody(BasicCellGrid<Layout>& grid, int seed)
+{
+    const int width = grid.getWidth();
+    const int chunkColumns = grid.getChunkColumns();
+    auto getChunkIndex = [chunkColumns, width](int index)
+    {
+        return (index / width / ChunkSize) * chunkColumns + index % width / ChunkSize;
+    };
+
+    const std::unique_ptr<Cell>& seedCell = grid.getCell(seed / width, seed % width);
+    if (!seedCell || seedCell->getTraits().type != CellType::Liquid)
+    {
+        return false;
+    }
+
+    const int seedChunk = getChunkIndex(seed);
+    LiquidChunk& chunk = refreshChunk(grid, seedChunk);
+    const uint8_t seedPiece = chunk.pieceOf[getLocalIndex(seed / width, seed % width)];
+    if (seedPiece == NoPiece || chunk.pieces[seedPiece].visitStamp >= solveStamp
+        || chunk.pieces[seedPiece].material != seedCell->getTraits().material)
+    {
+        return false;
+    }
+
+    ++stamp;
+    sources.clear();
+    slots.clear();
+    chunk.pieces[seedPiece].visitStamp = stamp;
+    frontier.assign(1, {seedChunk, seedPiece});
+    while (!frontier.empty())
+    {
+        const auto [chunkIndex, pieceIndex] = frontier.back();
+        frontier.pop_back();
+        // refreshing other chunks leaves the pieces of this one where they are
+        const BodyPiece& piece = chunks[chunkIndex].pieces[pieceIndex];
+        for (int index : piece.surface)
+        {
+            sources.push_back({index / width, index});
+        }
+        for (int index : piece.freeCells)
+        {
+            slots.push_back({index / width, index});
+        }
+
+        for (const auto& [index, neighbour] : piece.borders)
+        {
+            const int neighbourChunk = getChunkIndex(neighbour);
+            LiquidChunk& next = refreshChunk(grid, neighbourChunk);
+            const int local = getLocalIndex(neighbour / width, neighbour % width);
+            const MaterialId material = next.page->materials[local];
+            if (material == NoMaterial)
+            {
+                slots.push_back({neighbour / width, neighbour});
+                if (neighbour == index - width)
+                {
+                    sources.push_back({index / width, index});
+                }
+            }
+            else if (material == piece.material && next.pieceOf[local] != NoPiece && next.pieces[next.pieceOf[local]].visitStamp != stamp)
+            {
+                next.pieces[next.pieceOf[local]].visitStamp = stamp;
+                frontier.push_back({neighbourChunk, next.pieceOf[local]});
+            }
+        }
+    }
+    return true;
+}
+
+template <typename Layout>
+void LiquidSolver::levelBody(BasicCellGrid<Layout>& grid, MaterialId material)
+{
+    const int width = grid.getWidth();
+    auto isBody = [&grid, material](int r, int c)
+    {
+        return grid.isValidCellIndex(r, c) && getMaterial(grid, r, c) == material;
+    };
+
+    // surface cells with the highest on top. Free cells around the body with the lowest on top,
+    // free cells above the body count too, that is how the other side of communicating vessels fills up
+    const std::greater<RowEntry> highestFirst;
+    const std::less<RowEntry> lowestFirst;
+    std::make_heap(sources.begin(), sources.end(), highestFirst);
+    std::make_heap(slots.begin(), slots.end(), lowestFirst);
+
+    auto pushSource = [this, &highestFirst](int r, int index)
+    {
+        sources.push_back({r, index});
+        std::push_heap(sources.begin(), sources.end(), highestFirst);
+    };
+    auto pushSlots = [this, &grid, &lowestFirst, width](int r, int c)
+    {
+        constexpr int dirs[4][2] = {{0, -1}, {0, 1}, {1, 0}, {-1, 0}};
+        for (const auto dir : dirs)
+        {
+            if (isEmpty(grid, r + dir[0], c + dir[1]))
+            {
+                slots.push_back({r + dir[0], (r + dir[0]) * width + c + dir[1]});
+                std::push_heap(slots.begin(), slots.end(), lowestFirst);
+            }
+        }
+    };
+
+    // entries are not removed when a move makes them stale, they are checked when they come up instead
+    while (true)
+    {
+        while (!sources.empty())
+        {
+            const int r = sources.front().first;
+            const int c = sources.front().second % width;
+            if (isBody(r, c) && isEmpty(grid, r - 1, c))
+            {
+                break;
+            }
+            std::pop_heap(sources.begin(), sources.end(), highestFirst);
+            sources.pop_back();
+        }
+        while (!slots.empty())
+        {
+            const int r = slots.front().first;
+            const int c = slots.front().second % width;
+            if (isEmpty(grid, r, c) && (isBody(r - 1, c) || isBody(r + 1, c) || isBody(r, c - 1) || isBody(r, c + 1)))
+            {
+                break;
+            }
+            std::pop_heap(slots.begin(), slots.end(), lowestFirst);
+            slots.pop_back();
+        }
+        if (sources.empty() || slots.empty())
+        {
+            break;
+        }
+
+        const auto [sourceRow, sourceIndex] = sources.front();
+        const auto [slotRow, slotIndex] = slots.front();
+        // the body is level once no free cell next to it is lower than its surface
+        if (slotRow <= sourceRow)
+        {
+            break;
+        }
+        std::pop_heap(sources.begin(), sources.end(), highestFirst);
+        sources.pop_back();
+        std::pop_heap(slots.begin(), slots.end(), lowestFirst);
+        slots.pop_back();
+
+        const int sourceColumn = sourceIndex % width;
+        const int slotColumn = slotIndex % width;
+        grid.swapCells(sourceRow, sourceColumn, slotRow, slotColumn);
+
+        if (isBody(sourceRow + 1, sourceColumn))
+        {
+            pushSource(sourceRow + 1, sourceIndex + width);
+        }
+        if (isEmpty(grid, slotRow - 1, slotColumn))
+        {
+            pushSource(slotRow, slotIndex);
+        }
+        pushSlots(slotRow, slotColumn);
+    }
+}
+
+// the layouts of BasicCellGrid, see GridLayout.h
+#define INSTANTIATE_SOLVE(Layout) template void LiquidSolver::solve(BasicCellGrid<Layout>& grid, const std::vector<int>& seeds);
+GRID_LAYOUTS(INSTANTIATE_SOLVE)
+#undef INSTANTIATE_SOLVE
@@ -0,0 +1,73 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "CellGridFwd.h"
+#include "GridSnapshot.h"
+
+// Levels connected bodies of liquid at once instead of letting the surface cells walk sideways one cell per frame.
+// The highest surface cells of a body are moved into the lowest free cells next to it until no free cell
+// is lower than the surface, which also evens out communicating vessels.
+// Bodies are only visited when one of their cells came to rest next to the same liquid, a level body is left alone.
+// A body is put together from its pieces in every chunk. The pieces of a chunk are kept between steps
+// and only looked for again once the chunk changed, so a body costs its pieces, its surface and the free cells
+// around it instead of all of its cells.
+class LiquidSolver
+{
+public:
+    // seeds are indices of liquid cells, every body is levelled once even if it has many seeds
+    template <typename Layout>
+    void solve(BasicCellGrid<Layout>& grid, const std::vector<int>& seeds);
+
+private:
+    static constexpr uint8_t NoPiece = 255;
+    static_assert(ChunkArea / 2 < NoPiece, "every piece of a chunk needs its own number");
+
+    // cells of one liquid connected inside of a chunk
+    struct BodyPiece
+    {
+        MaterialId material = NoMaterial;
+        uint32_t visitStamp = 0;
+        // cells of the piece with a free cell above them in the same chunk
+        std::vector<int> surface;
+        // free cells of the chunk next to the piece, once for every cell of the piece they touch
+        std::vector<int> freeCells;
+        // cells of the piece on the border of the chunk and their neighbour in the next chunk
+        std::vector<std::pair<int, int>> borders;
+    };
+
+    struct LiquidChunk
+    {
+        // the page the pieces were found in. Holding it makes the grid copy the page on the next write,
+        // so the chunk changed when the grid has another page
+        std::shared_ptr<const ChunkPage> page;
+        std::array<uint8_t, ChunkArea> pieceOf;
+        std::vector<BodyPiece> pieces;
+        int pieceCount = 0;
+    };
+
+    // row and index of a cell
+    typedef std::pair<int, int> RowEntry;
+
+    std::vector<LiquidChunk> chunks;
+    // the pieces of a body carry the stamp of the last time it was collected, so nothing is cleared between bodies
+    uint32_t stamp = 0;
+    // first stamp of the running solve
+    uint32_t solveStamp = 0;
+    // chunk and piece
+    std::vector<std::pair<int, int>> frontier;
+    std::vector<int> localFrontier;
+    // heaps with the highest surface cell and the lowest free cell on top
+    std::vector<RowEntry> sources;
+    std::vector<RowEntry> slots;
+
+    template <typename Layout>
+    LiquidChunk& refreshChunk(const BasicCellGrid<Layout>& grid, int chunkIndex);
+    template <typename Layout>
+    bool collectBody(BasicCellGrid<Layout>& grid, int seed);
+    template <typename Layout>
+    void levelBody(BasicCellGrid<Layout>& grid, MaterialId material);
+};
@@ -0,0 +1,135 @@
+﻿#include "MargolusRules.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "Cell.h"
+
+namespace
+{
+    bool isFalling(BlockClass blockClass)
+    {
+        return blockClass == BlockClass::Grain || blockClass == BlockClass::Liquid;
+    }
+
+    bool isFluid(BlockClass blockClass)
+    {
+        return blockClass == BlockClass::Liquid || blockClass == BlockClass::Gas;
+    }
+
+    // the same cells a GrainCell or LiquidCell may fall into
+    bool canSinkInto(BlockClass upper, BlockClass lower)
+    {
+        if (!isFalling(upper))
+        {
+            return false;
+        }
+        return lower == BlockClass::Empty || lower == BlockClass::Gas || (upper == BlockClass::Grain && lower == BlockClass::Liquid);
+    }
+
+    bool canRiseInto(BlockClass lower, BlockClass upper)
+    {
+        return lower == BlockClass::Gas && upper == BlockClass::Empty;
+    }
+}
+
+MargolusRules::MargolusRules()
+{
+    for (int index = 0; index < static_cast<int>(table.size()); ++index)
+    {
+        std::array<BlockClass, 4> classes;
+        int rest = index;
+        for (BlockClass& blockClass : classes)
+        {
+            blockClass = static_cast<BlockClass>(rest % ClassCount);
+            rest /= ClassCount;
+        }
+        table[index] = buildMove(classes);
+    }
+}
+
+BlockClass MargolusRules::classify(const std::unique_ptr<Cell>& cell)
+{
+    if (!cell)
+    {
+        return BlockClass::Empty;
+    }
+
+    switch (cell->getTraits().type)
+    {
+        case CellType::Solid:
+            return BlockClass::Solid;
+        case CellType::Grain:
+            return BlockClass::Grain;
+        case CellType::Liquid:
+            return BlockClass::Liquid;
+        case CellType::Gas:
+            return BlockClass::Gas;
+    }
+    return BlockClass::Solid;
+}
+
+const BlockMove& MargolusRules::getMove(const BlockClass (&classes)[4]) const
+{
+    int index = 0;
+    for (int i = 3; i >= 0; --i)
+    {
+        index = index * ClassCount + static_cast<int>(classes[i]);
+    }
+    return table[index];
+}
+
+BlockMove MargolusRules::buildMove(std::array<BlockClass, 4> classes)
+{
+    BlockMove move;
+    bool moved[4] = {};
+    auto swapSlots = [&move, &moved, &classes](int a, int b)
+    {
+        move.swaps[move.swapCount][0] = static_cast<uint8_t>(std::min(a, b));
+        move.swaps[move.swapCount][1] = static_cast<uint8_t>(std::max(a, b));
+        ++move.swapCount;
+        std::swap(classes[a], classes[b]);
+        moved[a] = true;
+        moved[b] = true;
+    };
+
+    // falling and rising straight
+    for (int j = 0; j < 2; ++j)
+    {
+        if (canSinkInto(classes[j], classes[j + 2]) || canRiseInto(classes[j + 2], classes[j]))
+        {
+            swapSlots(j, j + 2);
+        }
+    }
+
+    // sliding down or up diagonally, the cell beside has to be free for the way not to go through a corner
+    for (int j = 0; j < 2; ++j)
+    {
+        const int other = 1 - j;
+        if (!moved[j] && !moved[other + 2] && !moved[other]
+            && canSinkInto(classes[j], classes[other + 2]) && (classes[other] == BlockClass::Empty || classes[other] == BlockClass::Gas))
+        {
+            swapSlots(j, other + 2);
+        }
+        else if (!moved[j + 2] && !moved[other] && !moved[other + 2]
+            && canRiseInto(classes[j + 2], classes[other]) && classes[other + 2] == BlockClass::Empty)
+        {
+            swapSlots(j + 2, other);
+        }
+    }
+
+    // spreading sideways, the bottom row first
+    for (int row : {2, 0})
+    {
+        if (moved[row] || moved[row + 1])
+        {
+            continue;
+        }
+        if ((isFluid(classes[row]) && classes[row + 1] == BlockClass::Empty) || (classes[row] == BlockClass::Empty && isFluid(classes[row + 1])))
+        {
+            swapSlots(row, row + 1);
+        }
+    }
+
+    return move;
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+
+class Cell;
+
+// what the rules of a Margolus block need to know about a cell
+enum class BlockClass : uint8_t
+{
+    Empty,
+    Solid,
+    Grain,
+    Liquid,
+    Gas,
+    Count
+};
+
+// Disjoint swaps of the cells of a 2x2 block.
+// Slots are 0 - top left, 1 - top right, 2 - bottom left, 3 - bottom right, a swap lists its smaller slot first
+struct BlockMove
+{
+    uint8_t swapCount = 0;
+    uint8_t swaps[2][2] = {};
+};
+
+// Transition table of the Margolus engine: the cell classes of a block decide how its cells are rearranged.
+// The rules follow the Cell subclasses: grains and liquids fall and slide down diagonally, liquids also spread
+// sideways, gases do the same upwards, solids never move. Densities are not part of the table,
+// a swap of two cells is only done when the cell that ends up below is the denser one.
+class MargolusRules
+{
+public:
+    MargolusRules();
+
+    static BlockClass classify(const std::unique_ptr<Cell>& cell);
+    const BlockMove& getMove(const BlockClass (&classes)[4]) const;
+
+private:
+    static constexpr int ClassCount = static_cast<int>(BlockClass::Count);
+
+    std::array<BlockMove, ClassCount * ClassCount * ClassCount * ClassCount> table;
+
+    static BlockMove buildMove(std::array<BlockClass, 4> classes);
+};
@@ -0,0 +1,16 @@
+﻿#pragma once
+#include <chrono>
+
+// Limits of one CellGrid::step, zero means no limit.
+// Updates that don't fit are deferred to the next step and go first there
+struct StepBudget
+{
+    // cell updates per step, split evenly over the domains
+    int maxUpdates = 0;
+    std::chrono::microseconds maxTime {0};
+
+    bool isUnbounded() const
+    {
+        return maxUpdates <= 0 && maxTime.count() <= 0;
+    }
+};
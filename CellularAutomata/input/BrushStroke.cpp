@@ -0,0 +1,132 @@
+﻿#include "BrushStroke.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+
+void BrushStroke::begin(int r, int c)
+{
+    active = true;
+    hasLastPoint = false;
+    painted.clear();
+    points.push_back({r, c});
+}
+
+void BrushStroke::moveTo(int r, int c)
+{
+    if (active)
+    {
+        points.push_back({r, c});
+    }
+}
+
+void BrushStroke::end()
+{
+    // samples that came before the release are still painted by the next takeEdit
+    active = false;
+}
+
+GridEdit BrushStroke::takeEdit(MaterialId material, int brushRadius)
+{
+    GridEdit edit;
+    edit.material = material;
+    if (material != strokeMaterial || brushRadius != strokeRadius)
+    {
+        // a different brush paints over the cells of the old one
+        painted.clear();
+        strokeMaterial = material;
+        strokeRadius = brushRadius;
+    }
+
+    for (const Point& point : points)
+    {
+        // row -> first and last column covered by this segment
+        std::map<int, std::pair<int, int>> rows;
+        sweepSegment(hasLastPoint ? lastPoint : point, point, brushRadius, rows);
+        for (const auto& [row, columns] : rows)
+        {
+            paintRow(row, columns.first, columns.second + 1, edit.spans);
+        }
+        lastPoint = point;
+        hasLastPoint = true;
+    }
+    points.clear();
+
+    if (!active)
+    {
+        hasLastPoint = false;
+    }
+    return edit;
+}
+
+void BrushStroke::sweepSegment(const Point& from, const Point& to, int brushRadius, std::map<int, std::pair<int, int>>& rows) const
+{
+    // Bresenham walk, every step stamps the brush square. Rows and columns of the walk only move one way,
+    // so the cells a segment covers in one row always form a single interval
+    const int dr = std::abs(to.row - from.row);
+    const int dc = std::abs(to.column - from.column);
+    const int stepRow = from.row < to.row ? 1 : -1;
+    const int stepColumn = from.column < to.column ? 1 : -1;
+    int error = dc - dr;
+    Point current = from;
+    while (true)
+    {
+        for (int r = current.row - brushRadius; r <= current.row + brushRadius; ++r)
+        {
+            auto [it, inserted] = rows.try_emplace(r, current.column - brushRadius, current.column + brushRadius);
+            if (!inserted)
+            {
+                it->second.first = std::min(it->second.first, current.column - brushRadius);
+                it->second.second = std::max(it->second.second, current.column + brushRadius);
+            }
+        }
+
+        if (current.row == to.row && current.column == to.column)
+        {
+            break;
+        }
+        const int doubledError = 2 * error;
+        if (doubledError > -dr)
+        {
+            error -= dr;
+            current.column += stepColumn;
+        }
+        if (doubledError < dc)
+        {
+            error += dc;
+            current.row += stepRow;
+        }
+    }
+}
+
+void BrushStroke::paintRow(int row, int begin, int end, std::vector<CellSpan>& spans)
+{
+    std::map<int, int>& intervals = painted[row];
+
+    // start from the interval that touches begin, if there is one
+    auto it = intervals.upper_bound(begin);
+    if (it != intervals.begin() && std::prev(it)->second >= begin)
+    {
+        --it;
+    }
+
+    int cursor = begin;
+    int mergedBegin = begin;
+    int mergedEnd = end;
+    while (it != intervals.end() && it->first <= end)
+    {
+        if (it->first > cursor)
+        {
+            spans.push_back({row, cursor, it->first});
+        }
+        cursor = std::max(cursor, it->second);
+        mergedBegin = std::min(mergedBegin, it->first);
+        mergedEnd = std::max(mergedEnd, it->second);
+        it = intervals.erase(it);
+    }
+    if (cursor < end)
+    {
+        spans.push_back({row, cursor, end});
+    }
+    intervals[mergedBegin] = mergedEnd;
+}
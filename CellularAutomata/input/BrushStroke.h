@@ -0,0 +1,40 @@
+﻿#pragma once
+#include <map>
+#include <vector>
+
+#include "../core/GridEdit.h"
+
+// Collects the cells the mouse went through between two ticks and turns them into one GridEdit.
+// The square brush is swept along straight lines between the samples, so fast strokes have no gaps,
+// and every cell is painted only once per stroke, so holding the brush still costs nothing.
+class BrushStroke
+{
+public:
+    void begin(int r, int c);
+    void moveTo(int r, int c);
+    void end();
+
+    // cells covered since the last call that have not been painted in this stroke yet.
+    // The brush covers a square of 2 * brushRadius + 1 cells around every sample
+    GridEdit takeEdit(MaterialId material, int brushRadius);
+
+private:
+    struct Point
+    {
+        int row = 0;
+        int column = 0;
+    };
+
+    bool active = false;
+    bool hasLastPoint = false;
+    Point lastPoint;
+    std::vector<Point> points;
+
+    MaterialId strokeMaterial = NoMaterial;
+    int strokeRadius = 0;
+    // painted columns of every row as disjoint [begin, end) intervals keyed by begin
+    std::map<int, std::map<int, int>> painted;
+
+    void sweepSegment(const Point& from, const Point& to, int brushRadius, std::map<int, std::pair<int, int>>& rows) const;
+    void paintRow(int row, int begin, int end, std::vector<CellSpan>& spans);
+};
@@ -0,0 +1,46 @@
+﻿#include "ConfigWatcher.h"
+
+ConfigWatcher::ConfigWatcher(std::chrono::milliseconds inPollInterval) : pollInterval(inPollInterval)
+{
+}
+
+void ConfigWatcher::watch(const std::vector<std::filesystem::path>& paths)
+{
+    files.clear();
+    files.reserve(paths.size());
+    for (const auto& path : paths)
+    {
+        files.push_back({path, getLastWrite(path)});
+    }
+    lastPoll = std::chrono::steady_clock::now();
+}
+
+bool ConfigWatcher::poll()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now - lastPoll < pollInterval)
+    {
+        return false;
+    }
+    lastPoll = now;
+
+    bool changed = false;
+    for (auto& file : files)
+    {
+        const auto lastWrite = getLastWrite(file.path);
+        if (lastWrite != file.lastWrite)
+        {
+            file.lastWrite = lastWrite;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+std::filesystem::file_time_type ConfigWatcher::getLastWrite(const std::filesystem::path& path)
+{
+    // a file that is being rewritten may be missing for a moment, it is reported as changed once it is back
+    std::error_code ec;
+    const auto lastWrite = std::filesystem::last_write_time(path, ec);
+    return ec ? std::filesystem::file_time_type::min() : lastWrite;
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+// Polls modification times of config files, so the matter traits can be reloaded while running
+class ConfigWatcher
+{
+public:
+    explicit ConfigWatcher(std::chrono::milliseconds inPollInterval = std::chrono::milliseconds(500));
+
+    void watch(const std::vector<std::filesystem::path>& paths);
+    // returns true once for every batch of changes, checks the files at most once per poll interval
+    bool poll();
+
+private:
+    struct WatchedFile
+    {
+        std::filesystem::path path;
+        std::filesystem::file_time_type lastWrite;
+    };
+
+    std::vector<WatchedFile> files;
+    std::chrono::milliseconds pollInterval;
+    std::chrono::steady_clock::time_point lastPoll;
+
+    static std::filesystem::file_time_type getLastWrite(const std::filesystem::path& path);
+};
@@ -1,70 +1,58 @@
 ﻿#include "Parser.h"
 
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+
 #include "../core/CoreTypes.h"
 
 
 constexpr char DEFAULT_CONFIG[] = "config.txt";
 
-Parser::Parser()
+namespace
 {
-    loadConfig(DEFAULT_CONFIG);
+    constexpr std::string_view whitespace = " \t";
+    constexpr std::string_view byteOrderMark = "\xEF\xBB\xBF";
+
+    std::string_view trimRight(std::string_view str)
+    {
+        const size_t last = str.find_last_not_of(whitespace);
+        return last == std::string_view::npos ? std::string_view() : str.substr(0, last + 1);
+    }
 }
 
-Parser::Parser(const std::string& inConfigName)
+Parser::Parser() : configPath(DEFAULT_CONFIG)
 {
-    loadConfig(inConfigName);
 }
 
-Parser::~Parser()
+Parser::Parser(const std::string& inConfigName) : configPath(inConfigName)
 {
-    fileHandle.close();
 }
 
-void Parser::parse()
+bool Parser::parse()
 {
-    std::string line = "";
-    bool startedMatter = false;
-    while (std::getline(fileHandle, line))
+    parseFile(configPath, 0, 0);
+    if (!sources.empty())
     {
-        if (line.empty())
+        currentFile = configPath.string();
+        if (width == 0)
         {
-            continue;
+            addError(0, 0, "'w' is not set");
         }
-        size_t delPos = line.find(':');
-        std::string trait = line.substr(0, delPos);
-        if (!startedMatter)
+        if (height == 0)
         {
-            if (trait == "h")
-            {
-                height  = std::stoi(line.substr(delPos + 1));
-            }
-            if (trait == "w")
-            {
-                width  = std::stoi(line.substr(delPos + 1));
-            }
-            if (trait == "s")
-            {
-                pixelSize  = std::stoi(line.substr(delPos + 1));
-            }
-            if (trait == "matter")
-            {
-                startedMatter = true;
-            }
+            addError(0, 0, "'h' is not set");
         }
-        else
+        if (pixelSize == 0)
         {
-            std::vector<std::string> matterTraits = {line};
-            while(std::getline(fileHandle, line))
-            {
-                if (line.empty())
-                {
-                    break;
-                }
-                matterTraits.push_back(line);
-            }
-            parseMatter(matterTraits);
+            addError(0, 0, "'s' is not set");
+        }
+        if (cells.empty() && errors.empty())
+        {
+            addError(0, 0, "no matter is defined");
         }
     }
+    return errors.empty();
 }
 
 int Parser::getPixelSize() const
@@ -77,53 +65,503 @@ std::pair<int, int> Parser::getDimensions() const
     return {width, height};
 }
 
+std::pair<int, int> Parser::getDomains() const
+{
+    return {domainRows, domainColumns};
+}
+
+int Parser::getThreadCount() const
+{
+    return threadCount;
+}
+
+bool Parser::getPinThreads() const
+{
+    return pinThreads != 0;
+}
+
+bool Parser::getDeterministic() const
+{
+    return deterministic != 0;
+}
+
+bool Parser::getLiquidLevelling() const
+{
+    return liquidLevelling != 0;
+}
+
+SimulationEngine Parser::getEngine() const
+{
+    return engine;
+}
+
+int Parser::getStepBudget() const
+{
+    return stepBudget;
+}
+
+int Parser::getChunkSleepTicks() const
+{
+    return chunkSleepTicks;
+}
+
+const std::string& Parser::getControlName() const
+{
+    return controlName;
+}
+
+int Parser::getHistoryBudget() const
+{
+    return historyBudget;
+}
+
+int Parser::getCheckpointInterval() const
+{
+    return checkpointInterval;
+}
+
 const std::vector<CellTraits>& Parser::getCells() const
 {
     return cells;
 }
 
-void Parser::loadConfig(const std::string& inConfigName)
+const std::vector<ParseError>& Parser::getErrors() const
 {
-    fileHandle.open(inConfigName, std::ios_base::in);
+    return errors;
 }
 
-void Parser::parseColor(std::string colorStr, CellTraits& outConfig)
+const std::vector<std::filesystem::path>& Parser::getSources() const
 {
-    size_t startPos = 0;
-    for (int& i : outConfig.color)
+    return sources;
+}
+
+void Parser::parseFile(const std::filesystem::path& path, int includeLine, int includeColumn)
+{
+    std::error_code ec;
+    const std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(path, ec);
+    if (std::find(includeStack.begin(), includeStack.end(), canonicalPath) != includeStack.end())
     {
-        size_t endPos = colorStr.find(',', startPos);
-        std::string comp = colorStr.substr(startPos, endPos);
-        i = std::stoi(comp);
-        startPos = endPos + 1;
+        addError(includeLine, includeColumn, "include cycle through '" + path.string() + "'");
+        return;
     }
+
+    std::ifstream fileHandle(path, std::ios_base::in | std::ios_base::binary);
+    if (!fileHandle)
+    {
+        if (includeStack.empty())
+        {
+            currentFile = path.string();
+            addError(0, 0, "cannot open file");
+        }
+        else
+        {
+            addError(includeLine, includeColumn, "cannot open included file '" + path.string() + "'");
+        }
+        return;
+    }
+
+    // the whole file goes into one buffer, all the tokens are views into it
+    fileHandle.seekg(0, std::ios_base::end);
+    std::string buffer(static_cast<size_t>(fileHandle.tellg()), '\0');
+    fileHandle.seekg(0, std::ios_base::beg);
+    fileHandle.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+    sources.push_back(path);
+    includeStack.push_back(canonicalPath);
+    const std::string parentFile = std::move(currentFile);
+    currentFile = path.string();
+
+    parseBuffer(buffer, path);
+
+    currentFile = parentFile;
+    includeStack.pop_back();
 }
 
-void Parser::parseMatter(const std::vector<std::string>& matterTraits)
+void Parser::parseBuffer(std::string_view buffer, const std::filesystem::path& path)
 {
-    CellTraits matterConfig;
-    for (int i = 0; i < matterTraits.size(); ++i)
+    if (buffer.substr(0, byteOrderMark.size()) == byteOrderMark)
     {
-        size_t delPos = matterTraits[i].find(':');
-        std::string trait = matterTraits[i].substr(0, delPos);
+        buffer.remove_prefix(byteOrderMark.size());
+    }
 
-        if (trait == "n")
+    MatterBlock block;
+    int lineNumber = 0;
+    size_t lineStart = 0;
+    while (lineStart < buffer.size())
+    {
+        size_t lineEnd = buffer.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos)
         {
-            matterConfig.name = matterTraits[i].substr(delPos + 1);
+            lineEnd = buffer.size();
+        }
+        std::string_view text = buffer.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        ++lineNumber;
+
+        if (!text.empty() && text.back() == '\r')
+        {
+            text.remove_suffix(1);
+        }
+
+        const size_t keyStart = text.find_first_not_of(whitespace);
+        if (keyStart == std::string_view::npos)
+        {
+            finishMatter(block);
+            continue;
         }
-        if (trait == "t")
+        if (text[keyStart] == '#')
         {
-            matterConfig.type = fromStr(matterTraits[i].substr(delPos + 1));
+            continue;
         }
-        if (trait == "d")
+
+        const size_t delPos = text.find(':', keyStart);
+        if (delPos == std::string_view::npos)
         {
-            matterConfig.density = std::stoi(matterTraits[i].substr(delPos + 1));
+            addError(lineNumber, static_cast<int>(keyStart) + 1, "expected 'key:value'");
+            continue;
         }
-        if (trait == "c")
+
+        Line line;
+        line.number = lineNumber;
+        line.key = trimRight(text.substr(keyStart, delPos - keyStart));
+        line.keyColumn = static_cast<int>(keyStart) + 1;
+        const size_t valueStart = std::min(text.find_first_not_of(whitespace, delPos + 1), text.size());
+        line.value = trimRight(text.substr(valueStart));
+        line.valueColumn = static_cast<int>(valueStart) + 1;
+
+        if (line.key == "include")
         {
-            parseColor(matterTraits[i].substr(delPos + 1), matterConfig);
+            if (block.startLine != 0)
+            {
+                addError(line.number, line.keyColumn, "include is not allowed inside a matter block");
+            }
+            else if (line.value.empty())
+            {
+                addError(line.number, line.valueColumn, "include path is empty");
+            }
+            else
+            {
+                parseFile(path.parent_path() / std::filesystem::path(line.value), line.number, line.valueColumn);
+            }
+            continue;
         }
 
+        if (!inMatters)
+        {
+            inMatters = parseHeaderLine(line);
+        }
+        else if (line.key == "matter" && block.startLine == 0)
+        {
+            // a matter library may start with its own 'matter:', the section is already open
+            if (!line.value.empty())
+            {
+                addError(line.number, line.valueColumn, "unexpected value after 'matter'");
+            }
+        }
+        else
+        {
+            parseMatterLine(line, block);
+        }
     }
-    cells.emplace_back(matterConfig);
+    finishMatter(block);
+}
+
+bool Parser::parseHeaderLine(const Line& line)
+{
+    if (line.key == "matter")
+    {
+        if (!line.value.empty())
+        {
+            addError(line.number, line.valueColumn, "unexpected value after 'matter'");
+        }
+        return true;
+    }
+
+    if (line.key == "h")
+    {
+        parseInt(line, 1, height);
+    }
+    else if (line.key == "w")
+    {
+        parseInt(line, 1, width);
+    }
+    else if (line.key == "s")
+    {
+        parseInt(line, 1, pixelSize);
+    }
+    else if (line.key == "domains")
+    {
+        parseDomains(line);
+    }
+    else if (line.key == "threads")
+    {
+        parseInt(line, 1, threadCount);
+    }
+    else if (line.key == "pin")
+    {
+        parseInt(line, 0, pinThreads);
+    }
+    else if (line.key == "deterministic")
+    {
+        parseInt(line, 0, deterministic);
+    }
+    else if (line.key == "levelling")
+    {
+        parseInt(line, 0, liquidLevelling);
+    }
+    else if (line.key == "budget")
+    {
+        parseInt(line, 0, stepBudget);
+    }
+    else if (line.key == "compress")
+    {
+        parseInt(line, 0, chunkSleepTicks);
+    }
+    else if (line.key == "history")
+    {
+        parseInt(line, 0, historyBudget);
+    }
+    else if (line.key == "checkpoint")
+    {
+        parseInt(line, 0, checkpointInterval);
+    }
+    else if (line.key == "control")
+    {
+        if (line.value.empty())
+        {
+            addError(line.number, line.valueColumn, "control name is empty");
+        }
+        controlName = line.value;
+    }
+    else if (line.key == "engine")
+    {
+        if (line.value == "queue")
+        {
+            engine = SimulationEngine::Queue;
+        }
+        else if (line.value == "margolus")
+        {
+            engine = SimulationEngine::Margolus;
+        }
+        else
+        {
+            addError(line.number, line.valueColumn, "unknown engine '" + std::string(line.value) + "', expected queue or margolus");
+        }
+    }
+    else
+    {
+        addError(line.number, line.keyColumn, "unknown key '" + std::string(line.key) + "'");
+    }
+    return false;
+}
+
+void Parser::parseMatterLine(const Line& line, MatterBlock& block)
+{
+    if (block.startLine == 0)
+    {
+        block = MatterBlock();
+        block.startLine = line.number;
+    }
+
+    bool* seen = nullptr;
+    if (line.key == "n")
+    {
+        seen = &block.hasName;
+    }
+    else if (line.key == "t")
+    {
+        seen = &block.hasType;
+    }
+    else if (line.key == "d")
+    {
+        seen = &block.hasDensity;
+    }
+    else if (line.key == "c")
+    {
+        seen = &block.hasColor;
+    }
+    else
+    {
+        addError(line.number, line.keyColumn, "unknown matter key '" + std::string(line.key) + "'");
+        block.ok = false;
+        return;
+    }
+
+    if (*seen)
+    {
+        addError(line.number, line.keyColumn, "'" + std::string(line.key) + "' is already set for this matter");
+        block.ok = false;
+        return;
+    }
+    // a malformed value still counts as set, so it is not reported as missing again
+    *seen = true;
+
+    if (line.key == "n")
+    {
+        if (line.value.empty())
+        {
+            addError(line.number, line.valueColumn, "matter name is empty");
+            block.ok = false;
+        }
+        block.traits.name = line.value;
+    }
+    else if (line.key == "t")
+    {
+        if (auto type = fromStr(line.value))
+        {
+            block.traits.type = *type;
+        }
+        else
+        {
+            addError(line.number, line.valueColumn, "unknown matter type '" + std::string(line.value) + "', expected gr, l, s or g");
+            block.ok = false;
+        }
+    }
+    else if (line.key == "d")
+    {
+        block.ok = parseInt(line, 0, block.traits.density) && block.ok;
+    }
+    else
+    {
+        block.ok = parseColor(line, block.traits) && block.ok;
+    }
+}
+
+void Parser::finishMatter(MatterBlock& block)
+{
+    if (block.startLine == 0)
+    {
+        return;
+    }
+
+    std::string missing;
+    for (auto [isSet, key] : {std::make_pair(block.hasName, "n"), std::make_pair(block.hasType, "t"),
+                              std::make_pair(block.hasDensity, "d"), std::make_pair(block.hasColor, "c")})
+    {
+        if (!isSet)
+        {
+            missing += missing.empty() ? "'" : ", '";
+            missing += key;
+            missing += "'";
+        }
+    }
+
+    if (!missing.empty())
+    {
+        addError(block.startLine, 1, "matter is missing " + missing);
+    }
+    else if (std::any_of(cells.begin(), cells.end(), [&block](const CellTraits& cell) { return cell.name == block.traits.name; }))
+    {
+        addError(block.startLine, 1, "matter '" + block.traits.name + "' is already defined");
+    }
+    else if (block.ok)
+    {
+        cells.emplace_back(block.traits);
+    }
+    block = MatterBlock();
+}
+
+bool Parser::parseInt(const Line& line, int minValue, int& outValue)
+{
+    const char* begin = line.value.data();
+    const char* end = begin + line.value.size();
+    int value = 0;
+    auto [ptr, ec] = std::from_chars(begin, end, value);
+    if (ec == std::errc::result_out_of_range)
+    {
+        addError(line.number, line.valueColumn, "number is out of range");
+        return false;
+    }
+    if (ec != std::errc())
+    {
+        addError(line.number, line.valueColumn, "expected a number");
+        return false;
+    }
+    if (ptr != end)
+    {
+        addError(line.number, line.valueColumn + static_cast<int>(ptr - begin), "unexpected character after a number");
+        return false;
+    }
+    if (value < minValue)
+    {
+        addError(line.number, line.valueColumn, "expected a number not less than " + std::to_string(minValue));
+        return false;
+    }
+
+    outValue = value;
+    return true;
+}
+
+bool Parser::parseColor(const Line& line, CellTraits& outConfig)
+{
+    const char* begin = line.value.data();
+    const char* end = begin + line.value.size();
+    const char* ptr = begin;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (i > 0)
+        {
+            if (ptr == end || *ptr != ',')
+            {
+                addError(line.number, line.valueColumn + static_cast<int>(ptr - begin), "expected ',' between color components");
+                return false;
+            }
+            ++ptr;
+        }
+
+        int comp = 0;
+        auto result = std::from_chars(ptr, end, comp);
+        if (result.ec != std::errc() || comp < 0 || comp > 255)
+        {
+            addError(line.number, line.valueColumn + static_cast<int>(ptr - begin), "expected a color component from 0 to 255");
+            return false;
+        }
+        outConfig.color[i] = comp;
+        ptr = result.ptr;
+    }
+
+    if (ptr != end)
+    {
+        addError(line.number, line.valueColumn + static_cast<int>(ptr - begin), "unexpected character after color");
+        return false;
+    }
+    return true;
+}
+
+bool Parser::parseDomains(const Line& line)
+{
+    const char* begin = line.value.data();
+    const char* end = begin + line.value.size();
+    int rows = 0;
+    int columns = 0;
+    auto rowsResult = std::from_chars(begin, end, rows);
+    if (rowsResult.ec != std::errc() || rows < 1)
+    {
+        addError(line.number, line.valueColumn, "expected domains as 'rows'x'columns'");
+        return false;
+    }
+
+    const char* ptr = rowsResult.ptr;
+    if (ptr == end || *ptr != 'x')
+    {
+        addError(line.number, line.valueColumn + static_cast<int>(ptr - begin), "expected 'x' between domain rows and columns");
+        return false;
+    }
+    ++ptr;
+
+    auto columnsResult = std::from_chars(ptr, end, columns);
+    if (columnsResult.ec != std::errc() || columns < 1 || columnsResult.ptr != end)
+    {
+        addError(line.number, line.valueColumn + static_cast<int>(ptr - begin), "expected a number of domain columns");
+        return false;
+    }
+
+    domainRows = rows;
+    domainColumns = columns;
+    return true;
+}
+
+void Parser::addError(int line, int column, const std::string& message)
+{
+    errors.push_back({currentFile, line, column, message});
 }
@@ -1,35 +1,114 @@
 ﻿#pragma once
-#include <fstream>
+#include <filesystem>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "../core/Cell.h"
 
-enum class CellType : uint8_t;
+struct ParseError
+{
+    std::string file;
+    int line = 0;
+    int column = 0;
+    std::string message;
+};
 
+// Reads the world and matter config. Every file is loaded into a single buffer and parsed in place.
+// Lines are "key:value", blank lines separate matter blocks and lines starting with '#' are comments.
+// "include:path" pulls in another file relative to the including one, e.g. a matter library.
+// The included lines are read as if they stood in place of the include, so a file included after "matter:"
+// holds matter blocks only and doesn't need a "matter:" line of its own.
 class Parser
 {
 public:
     Parser();
     explicit Parser(const std::string& inConfigName);
-    ~Parser();
 
-    void parse();
+    // returns false if any error has been found, the result is incomplete in that case
+    bool parse();
 
     int getPixelSize() const;
     std::pair<int, int> getDimensions() const;
+    // rows x columns of the grid domains that are stepped in parallel
+    std::pair<int, int> getDomains() const;
+    int getThreadCount() const;
+    bool getPinThreads() const;
+    // the result of a step doesn't depend on the domains and threads, at the cost of always using the smallest domains
+    bool getDeterministic() const;
+    bool getLiquidLevelling() const;
+    SimulationEngine getEngine() const;
+    // milliseconds a frame may spend stepping the grid, 0 for no limit
+    int getStepBudget() const;
+    // ticks a chunk has to sleep before it is compressed, 0 for never
+    int getChunkSleepTicks() const;
+    // name of the shared memory for external controllers, empty when there is none
+    const std::string& getControlName() const;
+    // megabytes the undo history may hold
+    int getHistoryBudget() const;
+    // ticks between checkpoints taken while the simulation runs, 0 for checkpoints on edits only
+    int getCheckpointInterval() const;
     const std::vector<CellTraits>& getCells() const;
+    const std::vector<ParseError>& getErrors() const;
+    // every file that has been read, including the included ones
+    const std::vector<std::filesystem::path>& getSources() const;
 
 private:
-    std::ifstream fileHandle;
+    struct Line
+    {
+        std::string_view key;
+        std::string_view value;
+        int number = 0;
+        int keyColumn = 0;
+        int valueColumn = 0;
+    };
+
+    struct MatterBlock
+    {
+        CellTraits traits = {};
+        bool hasName = false;
+        bool hasType = false;
+        bool hasDensity = false;
+        bool hasColor = false;
+        // cleared by any error inside the block, such a matter is not added
+        bool ok = true;
+        int startLine = 0;
+    };
+
+    std::filesystem::path configPath;
+    std::vector<std::filesystem::path> sources;
+    std::vector<std::filesystem::path> includeStack;
+    std::string currentFile;
+    // set once "matter:" has been read, it carries over into and out of included files
+    bool inMatters = false;
 
     int width = 0;
     int height = 0;
     int pixelSize = 0;
+    int domainRows = 1;
+    int domainColumns = 1;
+    int threadCount = 1;
+    int pinThreads = 0;
+    int deterministic = 0;
+    int liquidLevelling = 0;
+    SimulationEngine engine = SimulationEngine::Queue;
+    int stepBudget = 0;
+    int chunkSleepTicks = 0;
+    std::string controlName;
+    int historyBudget = 64;
+    int checkpointInterval = 0;
 
     std::vector<CellTraits> cells;
-    
-    void loadConfig(const std::string& inConfigName);
-    void parseColor(std::string colorStr, CellTraits& outConfig);
-    void parseMatter(const std::vector<std::string>& matterTraits);
+    std::vector<ParseError> errors;
+
+    void parseFile(const std::filesystem::path& path, int includeLine, int includeColumn);
+    void parseBuffer(std::string_view buffer, const std::filesystem::path& path);
+    bool parseHeaderLine(const Line& line);
+    void parseMatterLine(const Line& line, MatterBlock& block);
+    void finishMatter(MatterBlock& block);
+    bool parseInt(const Line& line, int minValue, int& outValue);
+    bool parseColor(const Line& line, CellTraits& outConfig);
+    bool parseDomains(const Line& line);
+
+    void addError(int line, int column, const std::string& message);
 };
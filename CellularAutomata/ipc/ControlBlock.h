@@ -0,0 +1,141 @@
+﻿#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../core/CoreTypes.h"
+
+// Layout of the shared memory between the simulation and an external controller.
+// Everything in here is plain data and lock free atomics, so both sides may be built separately
+constexpr uint32_t ControlMagic = 0x43414354;
+constexpr uint32_t ControlVersion = 2;
+constexpr uint32_t CommandCapacity = 1024;
+constexpr uint32_t TelemetryCapacity = 256;
+constexpr int MaxControlMaterials = 64;
+constexpr int MaterialNameSize = 32;
+
+enum class CommandType : uint32_t
+{
+    // one cell at top, left
+    Create,
+    // the rectangle [top, bottom) x [left, right)
+    Fill,
+    Clear
+};
+
+struct ControlCommand
+{
+    CommandType type = CommandType::Create;
+    MaterialId material = NoMaterial;
+    int32_t top = 0;
+    int32_t left = 0;
+    int32_t bottom = 0;
+    int32_t right = 0;
+};
+
+enum class TelemetryType : uint32_t
+{
+    Stats,
+    // the colours of the frame are in place, frame is the sequence to read them with
+    FrameReady
+};
+
+struct TelemetryEvent
+{
+    TelemetryType type = TelemetryType::Stats;
+    uint32_t frame = 0;
+    uint64_t tick = 0;
+    int32_t pendingCount = 0;
+    int32_t deferredCount = 0;
+    int32_t compressedChunks = 0;
+    int32_t appliedCommands = 0;
+};
+
+struct ControlMaterial
+{
+    char name[MaterialNameSize] = {};
+    uint8_t color[4] = {};
+};
+
+// Single producer single consumer queue, the producer only moves tail and the consumer only moves head
+template <typename T, uint32_t Capacity>
+struct SharedRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "the capacity of a ring must be a power of two");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "ring indices are shared between processes");
+
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) T items[Capacity];
+
+    void reset()
+    {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    bool push(const T& item)
+    {
+        const uint32_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        items[currentTail % Capacity] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, drops everything that has been pushed so far
+    void discard()
+    {
+        head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    bool pop(T& outItem)
+    {
+        const uint32_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        outItem = items[currentHead % Capacity];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// The colours of the last frame follow the block, one RGBA word per cell in rows.
+// frameSequence is odd while the simulation writes them, a reader that sees it change has to read again
+struct ControlBlock
+{
+    // set last, once everything else is in place
+    std::atomic<uint32_t> magic;
+    uint32_t version = 0;
+    // the simulation that made the block, set first. A block whose owner is gone may be replaced
+    std::atomic<uint32_t> ownerProcess;
+    int32_t width = 0;
+    int32_t height = 0;
+    std::atomic<uint32_t> droppedEvents;
+
+    // odd while the simulation rewrites the matters
+    std::atomic<uint32_t> materialSequence;
+    int32_t materialCount = 0;
+    ControlMaterial materials[MaxControlMaterials];
+
+    SharedRing<ControlCommand, CommandCapacity> commands;
+    SharedRing<TelemetryEvent, TelemetryCapacity> telemetry;
+
+    alignas(64) std::atomic<uint32_t> frameSequence;
+    uint64_t frameTick = 0;
+
+    static size_t getSize(int width, int height)
+    {
+        return getColorsOffset() + sizeof(uint32_t) * static_cast<size_t>(width) * height;
+    }
+
+    static size_t getColorsOffset()
+    {
+        return (sizeof(ControlBlock) + 63) / 64 * 64;
+    }
+};
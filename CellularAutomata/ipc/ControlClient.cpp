@@ -0,0 +1,142 @@
+﻿#include "ControlClient.h"
+
+#include <algorithm>
+#include <thread>
+
+bool ControlClient::connect(const std::string& name)
+{
+    disconnect();
+    if (!memory.open(name) || memory.getSize() < sizeof(ControlBlock))
+    {
+        memory.close();
+        return false;
+    }
+
+    block = static_cast<ControlBlock*>(memory.getData());
+    if (block->magic.load(std::memory_order_acquire) != ControlMagic || block->version != ControlVersion
+        || memory.getSize() < ControlBlock::getSize(block->width, block->height))
+    {
+        disconnect();
+        return false;
+    }
+    colors = reinterpret_cast<const uint32_t*>(static_cast<const char*>(memory.getData()) + ControlBlock::getColorsOffset());
+    // telemetry from before the controller came is of no use to it
+    block->telemetry.discard();
+    return true;
+}
+
+void ControlClient::disconnect()
+{
+    block = nullptr;
+    colors = nullptr;
+    memory.close();
+}
+
+bool ControlClient::isConnected() const
+{
+    return block != nullptr && block->magic.load(std::memory_order_acquire) == ControlMagic;
+}
+
+int ControlClient::getWidth() const
+{
+    return block ? block->width : 0;
+}
+
+int ControlClient::getHeight() const
+{
+    return block ? block->height : 0;
+}
+
+bool ControlClient::getMaterials(std::vector<ControlMaterial>& outMaterials) const
+{
+    outMaterials.clear();
+    // read again until the simulation wasn't rewriting them in between. A simulation that died
+    // in the middle of it leaves the sequence odd for good, so this gives up after a while
+    const auto deadline = std::chrono::steady_clock::now() + materialTimeout;
+    while (isConnected())
+    {
+        const uint32_t sequence = block->materialSequence.load(std::memory_order_acquire);
+        if (sequence % 2 == 0)
+        {
+            outMaterials.assign(block->materials, block->materials + std::clamp(block->materialCount, 0, MaxControlMaterials));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (block->materialSequence.load(std::memory_order_relaxed) == sequence)
+            {
+                return true;
+            }
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    outMaterials.clear();
+    return false;
+}
+
+MaterialId ControlClient::findMaterial(const std::string& name) const
+{
+    std::vector<ControlMaterial> materials;
+    if (!getMaterials(materials))
+    {
+        return NoMaterial;
+    }
+    for (size_t i = 0; i < materials.size(); ++i)
+    {
+        if (name == materials[i].name)
+        {
+            return static_cast<MaterialId>(i);
+        }
+    }
+    return NoMaterial;
+}
+
+bool ControlClient::create(int r, int c, MaterialId material)
+{
+    ControlCommand command;
+    command.type = CommandType::Create;
+    command.material = material;
+    command.top = r;
+    command.left = c;
+    return push(command);
+}
+
+bool ControlClient::fill(int top, int left, int bottom, int right, MaterialId material)
+{
+    ControlCommand command;
+    command.type = CommandType::Fill;
+    command.material = material;
+    command.top = top;
+    command.left = left;
+    command.bottom = bottom;
+    command.right = right;
+    return push(command);
+}
+
+bool ControlClient::clear(int top, int left, int bottom, int right)
+{
+    ControlCommand command;
+    command.type = CommandType::Clear;
+    command.top = top;
+    command.left = left;
+    command.bottom = bottom;
+    command.right = right;
+    return push(command);
+}
+
+bool ControlClient::pollTelemetry(TelemetryEvent& outEvent)
+{
+    return block != nullptr && block->telemetry.pop(outEvent);
+}
+
+uint32_t ControlClient::getDroppedEvents() const
+{
+    return block ? block->droppedEvents.load(std::memory_order_relaxed) : 0;
+}
+
+bool ControlClient::push(const ControlCommand& command)
+{
+    return block != nullptr && block->commands.push(command);
+}
@@ -0,0 +1,67 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ControlBlock.h"
+#include "SharedMemory.h"
+
+// The controller's side of the control interface, one controller per simulation.
+// Edits are queued to the simulation and applied before its next step,
+// telemetry and frames are read from the shared memory without copies on the simulation's side
+class ControlClient
+{
+public:
+    bool connect(const std::string& name);
+    void disconnect();
+    bool isConnected() const;
+
+    int getWidth() const;
+    int getHeight() const;
+    // the index of a matter is its MaterialId. Fails when the simulation is gone
+    // or hasn't finished rewriting the matters within materialTimeout
+    bool getMaterials(std::vector<ControlMaterial>& outMaterials) const;
+    MaterialId findMaterial(const std::string& name) const;
+
+    // all of them return false when the command ring is full
+    bool create(int r, int c, MaterialId material);
+    bool fill(int top, int left, int bottom, int right, MaterialId material);
+    bool clear(int top, int left, int bottom, int right);
+
+    bool pollTelemetry(TelemetryEvent& outEvent);
+    uint32_t getDroppedEvents() const;
+
+    // calls reader(colors, tick) with the colours of the latest frame right in the shared memory.
+    // Returns false when the frame was being written, the reader has to drop what it read then
+    template <typename F>
+    bool readFrame(const F& reader) const;
+
+private:
+    static constexpr std::chrono::milliseconds materialTimeout {500};
+
+    SharedMemory memory;
+    ControlBlock* block = nullptr;
+    const uint32_t* colors = nullptr;
+
+    bool push(const ControlCommand& command);
+};
+
+template <typename F>
+bool ControlClient::readFrame(const F& reader) const
+{
+    if (block == nullptr)
+    {
+        return false;
+    }
+
+    const uint32_t sequence = block->frameSequence.load(std::memory_order_acquire);
+    if (sequence == 0 || sequence % 2 != 0)
+    {
+        return false;
+    }
+    reader(colors, block->frameTick);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return block->frameSequence.load(std::memory_order_relaxed) == sequence;
+}
@@ -0,0 +1,140 @@
+﻿#include "ControlDriver.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace Drive
+{
+    constexpr int settleFrames = 120;
+    constexpr int statsInterval = 30;
+    constexpr std::chrono::seconds frameTimeout(5);
+    constexpr int readAttempts = 1000;
+}
+
+bool ControlDriver::connect(const std::string& name)
+{
+    if (!client.connect(name))
+    {
+        std::fprintf(stderr, "cannot connect to '%s', is the simulation running with control:%s?\n", name.c_str(), name.c_str());
+        return false;
+    }
+    if (!client.getMaterials(materials))
+    {
+        std::fprintf(stderr, "cannot read the matters of '%s'\n", name.c_str());
+        return false;
+    }
+    std::printf("connected to a %dx%d grid with %zu matters\n", client.getWidth(), client.getHeight(), materials.size());
+    return true;
+}
+
+bool ControlDriver::run()
+{
+    const int w = client.getWidth();
+    const int h = client.getHeight();
+    const int count = static_cast<int>(materials.size());
+    if (count == 0)
+    {
+        return true;
+    }
+
+    // a block of every matter side by side along the top
+    for (int i = 0; i < count; ++i)
+    {
+        client.fill(0, i * w / count, h / 8, (i + 1) * w / count, static_cast<MaterialId>(i));
+    }
+    if (!waitFrames(Drive::settleFrames))
+    {
+        return false;
+    }
+    printCounts(countFrame());
+
+    client.clear(0, 0, h, w);
+    if (!waitFrames(2))
+    {
+        return false;
+    }
+    std::vector<int> counts = countFrame();
+    int left = 0;
+    for (int cellCount : counts)
+    {
+        left += cellCount;
+    }
+    std::printf("after clear: %d cells left, %u telemetry events dropped\n", left, client.getDroppedEvents());
+    return true;
+}
+
+bool ControlDriver::waitFrames(int count)
+{
+    auto lastEvent = std::chrono::steady_clock::now();
+    int frames = 0;
+    while (frames < count)
+    {
+        TelemetryEvent event;
+        if (!client.pollTelemetry(event))
+        {
+            if (!client.isConnected() || std::chrono::steady_clock::now() - lastEvent > Drive::frameTimeout)
+            {
+                std::fprintf(stderr, "the simulation stopped sending frames\n");
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        lastEvent = std::chrono::steady_clock::now();
+        if (event.type == TelemetryType::FrameReady)
+        {
+            ++frames;
+        }
+        else if (frames % Drive::statsInterval == 0)
+        {
+            std::printf("tick %llu: %d pending, %d deferred, %d chunks compressed, %d commands applied\n",
+                static_cast<unsigned long long>(event.tick), event.pendingCount, event.deferredCount, event.compressedChunks, event.appliedCommands);
+        }
+    }
+    return true;
+}
+
+std::vector<int> ControlDriver::countFrame() const
+{
+    std::vector<uint32_t> colors(materials.size());
+    for (size_t i = 0; i < materials.size(); ++i)
+    {
+        std::memcpy(&colors[i], materials[i].color, sizeof(uint32_t));
+    }
+
+    const size_t cellCount = static_cast<size_t>(client.getWidth()) * client.getHeight();
+    std::vector<int> counts;
+    // matters with the same colour are counted as the first of them
+    auto countColors = [&counts, &colors, cellCount](const uint32_t* frame, uint64_t)
+    {
+        counts.assign(colors.size(), 0);
+        for (size_t i = 0; i < cellCount; ++i)
+        {
+            for (size_t material = 0; material < colors.size(); ++material)
+            {
+                if (frame[i] == colors[material])
+                {
+                    ++counts[material];
+                    break;
+                }
+            }
+        }
+    };
+
+    for (int attempt = 0; attempt < Drive::readAttempts && !client.readFrame(countColors); ++attempt)
+    {
+        std::this_thread::yield();
+    }
+    return counts;
+}
+
+void ControlDriver::printCounts(const std::vector<int>& counts) const
+{
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        std::printf("%-16s %d cells\n", materials[i].name, counts[i]);
+    }
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include "ControlClient.h"
+
+// Stand-in for external tooling, started with --drive <name> while the simulation runs with "control:<name>".
+// Drops a block of every matter through the control interface, follows the telemetry,
+// counts the matters in the frames and clears the grid again
+class ControlDriver
+{
+public:
+    bool connect(const std::string& name);
+    // returns false if the simulation stopped answering
+    bool run();
+
+private:
+    ControlClient client;
+    std::vector<ControlMaterial> materials;
+
+    bool waitFrames(int count);
+    std::vector<int> countFrame() const;
+    void printCounts(const std::vector<int>& counts) const;
+};
@@ -0,0 +1,272 @@
+﻿#include "ControlServer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "../core/CellGrid.h"
+
+ControlServer::~ControlServer()
+{
+    close();
+}
+
+bool ControlServer::open(const std::string& name, const CellGrid& grid)
+{
+    close();
+    const int width = grid.getWidth();
+    const int height = grid.getHeight();
+    const size_t size = ControlBlock::getSize(width, height);
+    if (!memory.create(name, size))
+    {
+        // another simulation with the same control name keeps its block
+        if (!isStale(name) || !SharedMemory::remove(name) || !memory.create(name, size))
+        {
+            return false;
+        }
+    }
+
+    block = new (memory.getData()) ControlBlock();
+    block->ownerProcess.store(SharedMemory::getProcessId(), std::memory_order_release);
+    block->version = ControlVersion;
+    block->width = width;
+    block->height = height;
+    block->droppedEvents.store(0, std::memory_order_relaxed);
+    block->materialSequence.store(0, std::memory_order_relaxed);
+    block->commands.reset();
+    block->telemetry.reset();
+    block->frameSequence.store(0, std::memory_order_relaxed);
+    colors = reinterpret_cast<uint32_t*>(static_cast<char*>(memory.getData()) + ControlBlock::getColorsOffset());
+    std::fill(colors, colors + static_cast<size_t>(width) * height, 0u);
+
+    publishMaterials(grid);
+    block->magic.store(ControlMagic, std::memory_order_release);
+
+    latestStats = FrameStats();
+    frames = std::make_unique<SnapshotExchange>();
+    publisher = std::thread(&ControlServer::publishLoop, this);
+    return true;
+}
+
+void ControlServer::close()
+{
+    if (frames)
+    {
+        frames->close();
+        publisher.join();
+        frames.reset();
+        writtenFrame = GridSnapshot();
+    }
+    if (block != nullptr)
+    {
+        block->magic.store(0, std::memory_order_release);
+    }
+    block = nullptr;
+    colors = nullptr;
+    memory.close();
+}
+
+bool ControlServer::isStale(const std::string& name)
+{
+    SharedMemory existing;
+    if (!existing.open(name) || existing.getSize() < sizeof(ControlBlock))
+    {
+        return false;
+    }
+    // a block of another version is left alone and so is one without an owner yet, it is being set up
+    const ControlBlock* other = static_cast<const ControlBlock*>(existing.getData());
+    const uint32_t owner = other->ownerProcess.load(std::memory_order_acquire);
+    return other->version == ControlVersion && owner != 0 && !SharedMemory::isProcessAlive(owner);
+}
+
+bool ControlServer::isOpen() const
+{
+    return block != nullptr;
+}
+
+void ControlServer::publishMaterials(const CellGrid& grid)
+{
+    if (block == nullptr)
+    {
+        return;
+    }
+
+    const int materialCount = grid.getMaterialCount();
+    block->materialSequence.fetch_add(1, std::memory_order_acq_rel);
+    block->materialCount = std::min(materialCount, MaxControlMaterials);
+    for (MaterialId material = 0; material < materialCount; ++material)
+    {
+        const CellTraits& traits = grid.getCellDefault(material)->getTraits();
+        ControlMaterial entry;
+        std::strncpy(entry.name, traits.name.c_str(), MaterialNameSize - 1);
+        toColor(traits, entry.color);
+        if (material < MaxControlMaterials)
+        {
+            block->materials[material] = entry;
+        }
+    }
+    block->materialSequence.fetch_add(1, std::memory_order_release);
+}
+
+int ControlServer::applyCommands(CellGrid& grid)
+{
+    if (block == nullptr)
+    {
+        return 0;
+    }
+
+    // at most one ring's worth per frame, a controller that keeps pushing can't stall the frame
+    int applied = 0;
+    ControlCommand command;
+    while (applied < static_cast<int>(CommandCapacity) && block->commands.pop(command))
+    {
+        GridEdit edit;
+        edit.material = command.type == CommandType::Clear ? NoMaterial : command.material;
+        if (command.type == CommandType::Create)
+        {
+            edit.spans.push_back({command.top, command.left, command.left + 1});
+        }
+        else
+        {
+            const int top = std::max(command.top, 0);
+            const int bottom = std::min(command.bottom, grid.getHeight());
+            for (int r = top; r < bottom; ++r)
+            {
+                edit.spans.push_back({r, command.left, command.right});
+            }
+        }
+        grid.applyEdit(edit);
+        ++applied;
+    }
+    appliedCommands += applied;
+    return applied;
+}
+
+void ControlServer::publishFrame(const CellGrid& grid)
+{
+    if (block == nullptr)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        latestStats.pendingCount = grid.getPendingCount();
+        latestStats.deferredCount = grid.getDeferredCount();
+        latestStats.compressedChunks = grid.getCompressedChunkCount();
+        latestStats.appliedCommands += appliedCommands;
+    }
+    appliedCommands = 0;
+    frames->publish(grid.snapshot());
+}
+
+void ControlServer::publishLoop()
+{
+    uint64_t seenVersion = 0;
+    while (frames->waitNewer(seenVersion))
+    {
+        GridSnapshot snapshot = frames->acquire();
+        FrameStats stats;
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats = latestStats;
+            latestStats.appliedCommands = 0;
+        }
+        writeFrame(std::move(snapshot), stats);
+    }
+}
+
+void ControlServer::writeFrame(GridSnapshot snapshot, const FrameStats& stats)
+{
+    // the snapshot carries the matters it was taken with, a reload shows up in the first frame after it
+    std::vector<uint32_t> palette(snapshot.getMaterialCount(), 0u);
+    for (MaterialId material = 0; material < palette.size(); ++material)
+    {
+        uint8_t color[4];
+        toColor(*snapshot.getTraits(material), color);
+        palette[material] = packColor(color);
+    }
+    // every colour is written again on the first frame and once the colours of the matters changed
+    const bool rewriteAll = !writtenFrame.isValid() || palette != materialColors;
+    materialColors = std::move(palette);
+
+    const uint32_t sequence = block->frameSequence.fetch_add(1, std::memory_order_acq_rel) + 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int chunkRow = 0; chunkRow < snapshot.getChunkRows(); ++chunkRow)
+    {
+        for (int chunkColumn = 0; chunkColumn < snapshot.getChunkColumns(); ++chunkColumn)
+        {
+            if (rewriteAll || snapshot.getPage(chunkRow, chunkColumn) != writtenFrame.getPage(chunkRow, chunkColumn))
+            {
+                writeChunk(snapshot, chunkRow, chunkColumn);
+            }
+        }
+    }
+    block->frameTick = snapshot.getTick();
+    block->frameSequence.store(sequence + 1, std::memory_order_release);
+
+    TelemetryEvent statsEvent;
+    statsEvent.type = TelemetryType::Stats;
+    statsEvent.frame = sequence + 1;
+    statsEvent.tick = snapshot.getTick();
+    statsEvent.pendingCount = stats.pendingCount;
+    statsEvent.deferredCount = stats.deferredCount;
+    statsEvent.compressedChunks = stats.compressedChunks;
+    statsEvent.appliedCommands = stats.appliedCommands;
+    pushEvent(statsEvent);
+
+    TelemetryEvent frameReady;
+    frameReady.type = TelemetryType::FrameReady;
+    frameReady.frame = sequence + 1;
+    frameReady.tick = snapshot.getTick();
+    pushEvent(frameReady);
+
+    // holding the snapshot keeps its pages from being reused, so a page that differs from one of it is a new one
+    writtenFrame = std::move(snapshot);
+}
+
+void ControlServer::writeChunk(const GridSnapshot& snapshot, int chunkRow, int chunkColumn)
+{
+    const ChunkPage& page = *snapshot.getPage(chunkRow, chunkColumn);
+    const int width = block->width;
+    const int top = chunkRow * ChunkSize;
+    const int left = chunkColumn * ChunkSize;
+    const int bottom = std::min(top + ChunkSize, block->height);
+    const int right = std::min(left + ChunkSize, width);
+    for (int r = top; r < bottom; ++r)
+    {
+        uint32_t* row = colors + static_cast<size_t>(r) * width;
+        const MaterialId* materials = &page.materials[(r - top) * ChunkSize];
+        for (int c = left; c < right; ++c)
+        {
+            const MaterialId material = materials[c - left];
+            row[c] = material < materialColors.size() ? materialColors[material] : 0u;
+        }
+    }
+}
+
+void ControlServer::pushEvent(const TelemetryEvent& event)
+{
+    // a controller that doesn't read its telemetry only loses events, the simulation never waits
+    if (!block->telemetry.push(event))
+    {
+        block->droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ControlServer::toColor(const CellTraits& traits, uint8_t (&outColor)[4])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        outColor[i] = static_cast<uint8_t>(std::clamp(traits.color[i], 0, 255));
+    }
+    outColor[3] = 255;
+}
+
+uint32_t ControlServer::packColor(const uint8_t (&color)[4])
+{
+    // the bytes stay in RGBA order in memory whatever the byte order of the machine
+    uint32_t packed = 0;
+    std::memcpy(&packed, color, sizeof(packed));
+    return packed;
+}
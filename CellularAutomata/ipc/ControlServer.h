@@ -0,0 +1,68 @@
+﻿#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ControlBlock.h"
+#include "SharedMemory.h"
+#include "../core/CellGridFwd.h"
+#include "../core/GridSnapshot.h"
+
+// The simulation's side of the control interface. Commands from the controller are applied between frames
+// and every stepped frame is published as stats and colours that the controller reads in place.
+// The colours are written by a thread of the server from snapshots, the simulation only takes the snapshot
+class ControlServer
+{
+public:
+    ControlServer() = default;
+    ~ControlServer();
+    ControlServer(const ControlServer& other) = delete;
+    ControlServer& operator=(const ControlServer& other) = delete;
+
+    bool open(const std::string& name, const CellGrid& grid);
+    void close();
+    bool isOpen() const;
+
+    // has to be called again after the matters are reloaded
+    void publishMaterials(const CellGrid& grid);
+    // returns the number of commands applied
+    int applyCommands(CellGrid& grid);
+    void publishFrame(const CellGrid& grid);
+
+private:
+    // what the simulation knew about the frame besides its cells
+    struct FrameStats
+    {
+        int pendingCount = 0;
+        int deferredCount = 0;
+        int compressedChunks = 0;
+        // since the publisher last took the stats
+        int appliedCommands = 0;
+    };
+
+    SharedMemory memory;
+    ControlBlock* block = nullptr;
+    uint32_t* colors = nullptr;
+    int appliedCommands = 0;
+
+    std::unique_ptr<SnapshotExchange> frames;
+    std::mutex statsMutex;
+    FrameStats latestStats;
+    std::thread publisher;
+    // only touched by the publisher, indexed by MaterialId
+    std::vector<uint32_t> materialColors;
+    // the last snapshot the colours were written from, only chunks whose page differs from it are written again
+    GridSnapshot writtenFrame;
+
+    void publishLoop();
+    void writeFrame(GridSnapshot snapshot, const FrameStats& stats);
+    void writeChunk(const GridSnapshot& snapshot, int chunkRow, int chunkColumn);
+    void pushEvent(const TelemetryEvent& event);
+    // the block of that name was left behind by a simulation that doesn't run anymore
+    static bool isStale(const std::string& name);
+    static void toColor(const CellTraits& traits, uint8_t (&outColor)[4]);
+    static uint32_t packColor(const uint8_t (&color)[4]);
+};
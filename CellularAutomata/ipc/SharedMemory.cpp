@@ -0,0 +1,222 @@
+﻿#include "SharedMemory.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::~SharedMemory()
+{
+    close();
+}
+
+#if defined(_WIN32)
+
+bool SharedMemory::create(const std::string& name, size_t inSize)
+{
+    close();
+    systemName = "Local\\" + name;
+    const unsigned long long mappingSize = inSize;
+    handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize & 0xffffffff), systemName.c_str());
+    if (handle == nullptr)
+    {
+        return false;
+    }
+    // an existing mapping of the name is handed out as well, it belongs to someone else
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        close();
+        return false;
+    }
+
+    data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, inSize);
+    if (data == nullptr)
+    {
+        close();
+        return false;
+    }
+    size = inSize;
+    owner = true;
+    return true;
+}
+
+bool SharedMemory::open(const std::string& name)
+{
+    close();
+    systemName = "Local\\" + name;
+    handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, systemName.c_str());
+    if (handle == nullptr)
+    {
+        return false;
+    }
+
+    data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (data == nullptr)
+    {
+        close();
+        return false;
+    }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(data, &info, sizeof(info));
+    size = info.RegionSize;
+    return true;
+}
+
+void SharedMemory::close()
+{
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (handle != nullptr)
+    {
+        // the mapping goes away with its last handle, there is no name to remove
+        CloseHandle(handle);
+    }
+    data = nullptr;
+    handle = nullptr;
+    size = 0;
+    owner = false;
+}
+
+bool SharedMemory::remove(const std::string& name)
+{
+    (void)name;
+    return false;
+}
+
+uint32_t SharedMemory::getProcessId()
+{
+    return GetCurrentProcessId();
+}
+
+bool SharedMemory::isProcessAlive(uint32_t processId)
+{
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processId);
+    if (process == nullptr)
+    {
+        // a process we may not open is still a process
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    }
+    const bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+}
+
+#else
+
+bool SharedMemory::create(const std::string& name, size_t inSize)
+{
+    close();
+    systemName = "/" + name;
+    const int descriptor = shm_open(systemName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (descriptor < 0)
+    {
+        return false;
+    }
+    owner = true;
+
+    if (ftruncate(descriptor, static_cast<off_t>(inSize)) != 0)
+    {
+        ::close(descriptor);
+        close();
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, inSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    data = mapping;
+    size = inSize;
+    return true;
+}
+
+bool SharedMemory::open(const std::string& name)
+{
+    close();
+    systemName = "/" + name;
+    const int descriptor = shm_open(systemName.c_str(), O_RDWR, 0);
+    if (descriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size <= 0)
+    {
+        ::close(descriptor);
+        return false;
+    }
+
+    const size_t mappingSize = static_cast<size_t>(status.st_size);
+    void* mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    data = mapping;
+    size = mappingSize;
+    return true;
+}
+
+void SharedMemory::close()
+{
+    if (data != nullptr)
+    {
+        munmap(data, size);
+    }
+    if (owner)
+    {
+        shm_unlink(systemName.c_str());
+    }
+    data = nullptr;
+    size = 0;
+    owner = false;
+}
+
+bool SharedMemory::remove(const std::string& name)
+{
+    return shm_unlink(("/" + name).c_str()) == 0;
+}
+
+uint32_t SharedMemory::getProcessId()
+{
+    return static_cast<uint32_t>(getpid());
+}
+
+bool SharedMemory::isProcessAlive(uint32_t processId)
+{
+    // signal 0 only checks that the process is there, EPERM means it is but belongs to another user
+    return kill(static_cast<pid_t>(processId), 0) == 0 || errno == EPERM;
+}
+
+#endif
+
+bool SharedMemory::isOpen() const
+{
+    return data != nullptr;
+}
+
+void* SharedMemory::getData() const
+{
+    return data;
+}
+
+size_t SharedMemory::getSize() const
+{
+    return size;
+}
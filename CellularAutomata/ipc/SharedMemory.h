@@ -0,0 +1,40 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A named block of memory that other processes on the machine can map.
+// POSIX shared memory on Linux and macOS, a pagefile backed file mapping on Windows
+class SharedMemory
+{
+public:
+    SharedMemory() = default;
+    ~SharedMemory();
+    SharedMemory(const SharedMemory& other) = delete;
+    SharedMemory& operator=(const SharedMemory& other) = delete;
+
+    // the creator owns the name and removes it again on close. Fails if the name is taken
+    bool create(const std::string& name, size_t size);
+    bool open(const std::string& name);
+    void close();
+    // takes the name away from a block whose creator is gone, those who have it open keep it.
+    // On Windows the block goes away with its last handle and this always fails
+    static bool remove(const std::string& name);
+
+    // for the owner checks of the blocks
+    static uint32_t getProcessId();
+    static bool isProcessAlive(uint32_t processId);
+
+    bool isOpen() const;
+    void* getData() const;
+    size_t getSize() const;
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    bool owner = false;
+    std::string systemName;
+#if defined(_WIN32)
+    void* handle = nullptr;
+#endif
+};
@@ -0,0 +1,49 @@
+﻿#pragma once
+#include <cstddef>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#endif
+
+// Bytes of the process that are in physical memory, 0 where it can't be read.
+// Freed heap is handed back to the system first where the allocator allows it, so the number follows what is in use
+inline size_t getResidentBytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#elif defined(__linux__)
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+    // the second number is the resident set in pages
+    size_t pages = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r"))
+    {
+        unsigned long total = 0;
+        unsigned long resident = 0;
+        if (std::fscanf(statm, "%lu %lu", &total, &resident) == 2)
+        {
+            pages = resident;
+        }
+        std::fclose(statm);
+    }
+    return pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,86 @@
+﻿#pragma once
+#include <cstdint>
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware cache misses of the calling thread. Only on Linux and only where perf events are allowed,
+// everywhere else isAvailable is false and the count stays 0
+class PerfCounter
+{
+public:
+    PerfCounter();
+    ~PerfCounter();
+    PerfCounter(const PerfCounter& other) = delete;
+    PerfCounter& operator=(const PerfCounter& other) = delete;
+
+    bool isAvailable() const;
+    void start();
+    // returns the misses since start
+    uint64_t stop();
+
+private:
+    int descriptor = -1;
+};
+
+inline PerfCounter::PerfCounter()
+{
+#if defined(__linux__)
+    perf_event_attr attributes;
+    std::memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    descriptor = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+}
+
+inline PerfCounter::~PerfCounter()
+{
+#if defined(__linux__)
+    if (descriptor >= 0)
+    {
+        close(descriptor);
+    }
+#endif
+}
+
+inline bool PerfCounter::isAvailable() const
+{
+    return descriptor >= 0;
+}
+
+inline void PerfCounter::start()
+{
+#if defined(__linux__)
+    if (descriptor >= 0)
+    {
+        ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+        ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+inline uint64_t PerfCounter::stop()
+{
+    uint64_t count = 0;
+#if defined(__linux__)
+    if (descriptor >= 0)
+    {
+        ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(descriptor, &count, sizeof(count)) != sizeof(count))
+        {
+            count = 0;
+        }
+    }
+#endif
+    return count;
+}
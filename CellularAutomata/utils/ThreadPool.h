@@ -0,0 +1,230 @@
+﻿#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Fixed set of workers for fork-join loops. The calling thread takes part in every loop,
+// so a pool with N workers runs N + 1 tasks at once. Pinning only applies to the workers.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int workerCount, bool pinThreads = false);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    int getThreadCount() const;
+
+    // runs task(i) for every i in [0, count) and returns once all of them are done.
+    // Indices are split statically, so the same index always lands on the same thread.
+    template <typename F>
+    void parallelFor(int count, const F& task);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+
+    std::function<void(int)> job;
+    int jobCount = 0;
+    int generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+
+    void runJob(int slot);
+    void workerLoop(int slot);
+    static void pinCurrentThread(int cpu);
+    // the cpus the process may run on, those of one NUMA node next to each other
+    static std::vector<int> getCpusByNode();
+};
+
+inline ThreadPool::ThreadPool(int workerCount, bool pinThreads)
+{
+    // slot i goes to the i-th cpu, so the threads fill up one node before the next one is used.
+    // The calling thread is often the UI thread and keeps its affinity, the first cpu is left to it
+    const std::vector<int> cpus = pinThreads ? getCpusByNode() : std::vector<int>();
+    for (int i = 0; i < workerCount; ++i)
+    {
+        const int cpu = cpus.empty() ? -1 : cpus[(i + 1) % cpus.size()];
+        workers.emplace_back([this, i, cpu]()
+        {
+            if (cpu >= 0)
+            {
+                pinCurrentThread(cpu);
+            }
+            workerLoop(i + 1);
+        });
+    }
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+inline int ThreadPool::getThreadCount() const
+{
+    return static_cast<int>(workers.size()) + 1;
+}
+
+template <typename F>
+void ThreadPool::parallelFor(int count, const F& task)
+{
+    if (workers.empty() || count <= 1)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = [&task](int i) { task(i); };
+        jobCount = count;
+        busyWorkers = static_cast<int>(workers.size());
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    runJob(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this]() { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+inline void ThreadPool::runJob(int slot)
+{
+    const int threadCount = getThreadCount();
+    for (int i = slot; i < jobCount; i += threadCount)
+    {
+        job(i);
+    }
+}
+
+inline void ThreadPool::workerLoop(int slot)
+{
+    int seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [this, seenGeneration]() { return stopping || generation != seenGeneration; });
+            if (stopping)
+            {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        runJob(slot);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0)
+        {
+            doneCondition.notify_one();
+        }
+    }
+}
+
+inline void ThreadPool::pinCurrentThread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#else
+    (void)cpu;
+#endif
+}
+
+inline std::vector<int> ThreadPool::getCpusByNode()
+{
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return cpus;
+    }
+
+    // sysfs lists nodes and cpus as ranges like "0-3,8-11"
+    auto readList = [](const std::string& path)
+    {
+        std::vector<int> values;
+        std::ifstream file(path);
+        std::string ranges;
+        if (!file || !std::getline(file, ranges))
+        {
+            return values;
+        }
+        size_t position = 0;
+        while (position < ranges.size())
+        {
+            size_t end = ranges.find(',', position);
+            if (end == std::string::npos)
+            {
+                end = ranges.size();
+            }
+            const std::string range = ranges.substr(position, end - position);
+            position = end + 1;
+
+            const size_t dash = range.find('-');
+            const int first = std::atoi(range.c_str());
+            const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int value = first; value <= last; ++value)
+            {
+                values.push_back(value);
+            }
+        }
+        return values;
+    };
+
+    std::vector<bool> listed(CPU_SETSIZE, false);
+    for (int node : readList("/sys/devices/system/node/online"))
+    {
+        for (int cpu : readList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE && !listed[cpu] && CPU_ISSET(cpu, &allowed))
+            {
+                listed[cpu] = true;
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    // without NUMA support in the kernel there are no nodes, the allowed cpus are taken in order
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!listed[cpu] && CPU_ISSET(cpu, &allowed))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
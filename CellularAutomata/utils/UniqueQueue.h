@@ -11,6 +11,7 @@ public:
     void clear();
     const T& front() const;
     bool empty() const;
+    size_t size() const;
     bool contains(const T& element) const;
 private:
     std::queue<T> queue;
@@ -65,6 +66,12 @@ bool UniqueQueue<T>::empty() const
     return queue.empty();
 }
 
+template <typename T>
+size_t UniqueQueue<T>::size() const
+{
+    return queue.size();
+}
+
 template <typename T>
 bool UniqueQueue<T>::contains(const T& element) const
 {